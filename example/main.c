@@ -1,5 +1,4 @@
 #include "naett.h"
-#include <unistd.h>
 #include <stdio.h>
 
 int main(int argc, char** argv) {
@@ -14,9 +13,7 @@ int main(int argc, char** argv) {
     naettReq* req = naettRequest(URL, naettMethod("GET"), naettHeader("accept", "*/*"));
     naettRes* res = naettMake(req);
 
-    while (!naettComplete(res)) {
-        usleep(100 * 1000);
-    }
+    naettWait(res, -1);
 
     int status = naettGetStatus(res);
 
@@ -5,6 +5,8 @@
 #ifndef NAETT_INTERNAL_H
 #define NAETT_INTERNAL_H
 
+#include <stddef.h>
+
 #ifdef _MSC_VER
     #define strcasecmp _stricmp
     #undef strdup
@@ -42,6 +44,38 @@
 #endif
 #endif
 
+#if __WINDOWS__
+typedef SRWLOCK naettMutex;
+typedef CONDITION_VARIABLE naettCond;
+#define naettMutexInit(MUTEX) InitializeSRWLock(MUTEX)
+#define naettMutexLock(MUTEX) AcquireSRWLockExclusive(MUTEX)
+#define naettMutexUnlock(MUTEX) ReleaseSRWLockExclusive(MUTEX)
+#define naettMutexDestroy(MUTEX) ((void)(MUTEX))
+#define naettCondInit(COND) InitializeConditionVariable(COND)
+#define naettCondBroadcast(COND) WakeAllConditionVariable(COND)
+#define naettCondDestroy(COND) ((void)(COND))
+#define naettAtomicCAS(PTR, EXPECTED, DESIRED) \
+    (InterlockedCompareExchange((volatile LONG*)(PTR), (DESIRED), (EXPECTED)) == (EXPECTED))
+#define naettAtomicLoad(PTR) InterlockedCompareExchange((volatile LONG*)(PTR), 0, 0)
+#define naettAtomicStore(PTR, VALUE) InterlockedExchange((volatile LONG*)(PTR), (VALUE))
+#define naettAtomicAdd(PTR, VALUE) (InterlockedExchangeAdd((volatile LONG*)(PTR), (VALUE)) + (VALUE))
+#else
+#include <pthread.h>
+typedef pthread_mutex_t naettMutex;
+typedef pthread_cond_t naettCond;
+#define naettMutexInit(MUTEX) pthread_mutex_init(MUTEX, NULL)
+#define naettMutexLock(MUTEX) pthread_mutex_lock(MUTEX)
+#define naettMutexUnlock(MUTEX) pthread_mutex_unlock(MUTEX)
+#define naettMutexDestroy(MUTEX) pthread_mutex_destroy(MUTEX)
+#define naettCondInit(COND) pthread_cond_init(COND, NULL)
+#define naettCondBroadcast(COND) pthread_cond_broadcast(COND)
+#define naettCondDestroy(COND) pthread_cond_destroy(COND)
+#define naettAtomicCAS(PTR, EXPECTED, DESIRED) __sync_bool_compare_and_swap((PTR), (EXPECTED), (DESIRED))
+#define naettAtomicLoad(PTR) __atomic_load_n((PTR), __ATOMIC_SEQ_CST)
+#define naettAtomicStore(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define naettAtomicAdd(PTR, VALUE) __atomic_add_fetch((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#endif
+
 #define naettAlloc(TYPE, VAR) TYPE* VAR = (TYPE*)calloc(1, sizeof(TYPE))
 
 typedef struct KVLink {
@@ -50,21 +84,87 @@ typedef struct KVLink {
     struct KVLink* next;
 } KVLink;
 
+// Bump allocator for data living as long as a response, such as its headers.
+// Blocks are only freed all at once, when the response is closed.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* blocks;
+} Arena;
+
+typedef struct HeaderEntry {
+    const char* name;
+    const char* value;
+    size_t nameLength;
+    unsigned int hash;  // Of the lower case name
+} HeaderEntry;
+
+// Response headers in arrival order, indexed by an open addressing hash table
+// of `2 * capacity` slots, each holding an entry index + 1, or 0 if empty.
+// A slot refers to the latest header of its name. All storage is in the response arena.
+typedef struct HeaderTable {
+    HeaderEntry* entries;
+    int* slots;
+    int count;
+    int capacity;
+} HeaderTable;
+
 typedef struct Buffer {
     void* data;
-    int size;
-    int capacity;
-    int position;
+    long long size;
+    long long capacity;
+    long long position;
 } Buffer;
 
+typedef struct InternalClient {
+    naettConfig config;
+    // Admission control state, see `maxActive` and `maxQueued` in naettConfig.
+    naettMutex admissionLock;
+    int numActive;
+    int numQueued;
+    struct InternalResponse* firstQueued;
+    struct InternalResponse* lastQueued;
+    // Signalled when responses of the client complete. The lock protects the
+    // completion queue, and is held while responses are marked complete.
+    naettMutex completionLock;
+    naettCond completionSignal;
+    // Completed responses without completion callbacks, not yet collected by
+    // `naettClientGetCompleted`.
+    struct InternalResponse* firstCompleted;
+    struct InternalResponse* lastCompleted;
+#if __LINUX__
+    struct Worker* workers;
+    int numWorkers;
+    CURLSH* share;
+    int completionFD;
+    pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+#endif
+} InternalClient;
+
 typedef struct {
+    InternalClient* client;
     const char* method;
     const char* userAgent;
     int timeoutMS;
+    int deadlineMS;
+    int firstByteTimeoutMS;
+    int idleTimeoutMS;
+    int lowSpeedBytesPerSecond;
+    int lowSpeedSeconds;
+    int httpVersion;
+    // At most one of the plain and 64-bit variants is used, see `naettReadBody`.
     naettReadFunc bodyReader;
+    naettReadFunc64 bodyReader64;
     void* bodyReaderData;
     naettWriteFunc bodyWriter;
+    naettWriteFunc64 bodyWriter64;
     void* bodyWriterData;
+    naettCompleteFunc onComplete;
+    void* onCompleteData;
     KVLink* headers;
     Buffer body;
 } RequestOptions;
@@ -72,29 +172,77 @@ typedef struct {
 typedef struct {
     RequestOptions options;
     const char* url;
+    // Number of requests sharing the strings and header list of the options, and the
+    // platform state that does not depend on the URL, see `naettReqClone`.
+    // Only changed with naettAtomicAdd.
+    int* refCount;
 #if __APPLE__
     id urlRequest;
 #endif
 #if __ANDROID__
     jobject urlObject;
 #endif
+#if __LINUX__
+    unsigned int hostHash;
+    // Built once, shared read-only by all responses to this request and its clones.
+    struct curl_slist* headerList;
+#endif
 #if __WINDOWS__
     HINTERNET session;
     HINTERNET connection;
-    HINTERNET request;
     LPWSTR host;
     LPWSTR resource;
+    LPWSTR verb;
+    LPWSTR headers;
+    DWORD openFlags;
 #endif
 } InternalRequest;
 
-typedef struct {
+// Values of `InternalResponse.cancelState`, only changed with naettAtomicCAS.
+enum {
+    naettTransferRunning = 0,
+    naettTransferCancelled,
+    // Completing normally, too late to cancel.
+    naettTransferFinishing,
+};
+
+// Flags of `InternalResponse.closeState`, only changed with naettAtomicCAS.
+enum {
+    // The completion callback is running.
+    naettInCallback = 1,
+    // `naettClose` has been called. Set during the callback, the thread running it frees the response.
+    naettClosing = 2,
+};
+
+typedef struct InternalResponse {
     InternalRequest* request;
     int code;
+    // Set with the completion lock of the client held, and read with naettAtomicLoad.
     int complete;
-    KVLink* headers;
+    int cancelState;
+    int closeState;
+    // Set while the response holds an admission slot of its client.
+    int admitted;
+    // Set while the response waits in the admission queue of its client. Changed with the
+    // admission lock held, and read without it with naettAtomicLoad.
+    int queued;
+    // Links in the admission queue, or in a batch passed to naettPlatformMakeRequests.
+    struct InternalResponse* nextQueued;
+    struct InternalResponse* prevQueued;
+    // See `naettAddHeader`.
+    HeaderTable headers;
+    Arena arena;
     Buffer body;
-    int contentLength;  // 0 if headers not read, -1 if Content-Length missing.
-    int totalBytesRead;
+    // Per response state of the request body reader and response body writer,
+    // so that a request can be made many times concurrently.
+    Buffer requestBody;
+    void* bodyReaderData;
+    void* bodyWriterData;
+    long long contentLength;  // 0 if headers not read, -1 if Content-Length missing.
+    long long totalBytesRead;
+    // Links in the completion queue of the client, or in a batch passed to naettCompleteResponses.
+    struct InternalResponse* nextCompleted;
+    struct InternalResponse* prevCompleted;
 #if __APPLE__
     id session;
 #endif
@@ -103,19 +251,82 @@ typedef struct {
     int closeRequested;
 #endif
 #if __LINUX__
-    struct curl_slist* headerList;
+    struct InternalResponse* nextSubmitted;
+    struct InternalResponse* nextCancelled;
+    // Worker thread only. The easy handle while the transfer is running, and
+    // whether the worker has taken the response off the submission stack.
+    CURL* handle;
+    int added;
+    // Worker thread only. Links in the worker's list of transfers with timeouts,
+    // see `naettDeadline`, `naettFirstByteTimeout` and `naettIdleTimeout`.
+    struct InternalResponse* nextTimed;
+    struct InternalResponse* prevTimed;
+    int timed;
+    int receivedData;
+    long long startMS;
+    long long lastReceiveMS;
+    // Worker thread only. CLOCK_MONOTONIC time in nanoseconds at which the transfer
+    // was added to the multi handle, for measuring dispatch latency.
+    long long addedNS;
 #endif
 #if __WINDOWS__
+    HINTERNET handle;
     char buffer[10240];
     size_t bytesLeft;
 #endif
 } InternalResponse;
 
 void naettPlatformInit(naettInitData initData);
+int naettPlatformInitClient(InternalClient* client);
+void naettPlatformFreeClient(InternalClient* client);
 int naettPlatformInitRequest(InternalRequest* req);
+// Updates the platform state of an initialized request after its URL changed.
+// Returns 0 if the URL is not usable, leaving the previous state in place.
+int naettPlatformSetURL(InternalRequest* req);
+// Initializes the platform state of a copy of `source` with a different URL, see `naettReqClone`.
+// Returns 0 if the URL is not usable.
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source);
 void naettPlatformMakeRequest(InternalResponse* res);
+// Makes a list of requests, linked through `nextQueued`.
+void naettPlatformMakeRequests(InternalResponse* first);
 void naettPlatformFreeRequest(InternalRequest* req);
+// Frees the platform state shared by a request and its clones, once the last of them is freed.
+void naettPlatformFreeSharedRequest(InternalRequest* req);
 void naettPlatformCloseResponse(InternalResponse* res);
+// Aborts a running request, which completes with `naettCancelledError`.
+// Called at most once per response.
+void naettPlatformCancelResponse(InternalResponse* res);
+int naettPlatformCompletionFD(InternalClient* client);
+// Makes the completion descriptor of a client readable, or not.
+void naettPlatformSignalCompletion(InternalClient* client, int pending);
+
+// Returns pointer aligned, uninitialized memory that stays valid until `naettArenaFree`.
+void* naettArenaAlloc(Arena* arena, size_t size);
+void naettArenaFree(Arena* arena);
+
+// Adds a response header, copying name and value into the response arena.
+// Neither needs to be zero terminated.
+void naettAddHeader(InternalResponse* res, const char* name, size_t nameLength, const char* value, size_t valueLength);
+
+// Calls the body reader or writer of a request, whichever variant is set, with
+// per response reader or writer data.
+long long naettReadBody(const InternalRequest* req, void* readerData, void* dest, long long bufferSize);
+long long naettWriteBody(const InternalRequest* req, void* writerData, const void* source, long long bytes);
+
+// Parses one header line, with or without its line ending, into the response headers.
+// A status line starts over with a new set of headers, as after a redirect or an interim
+// response, and lines starting with whitespace continue the previous header value.
+// Duplicate headers are all kept, with `naettGetHeader` finding the latest.
+// Returns 1 for the empty line ending a set of headers, 0 otherwise.
+int naettParseHeaderLine(InternalResponse* res, const char* line, size_t length);
+// Called when all headers are in. Sets `contentLength`, and reserves room for the body
+// in the default body buffer.
+void naettHeadersReceived(InternalResponse* res);
+
+// Marks a response as complete. Completing an already completed response does nothing.
+void naettCompleteResponse(InternalResponse* res);
+// Marks a list of pending responses, linked through `nextCompleted`, as complete.
+void naettCompleteResponses(InternalResponse* first);
 
 #endif  // NAETT_INTERNAL_H
 // End of inlined naett_internal.h //
@@ -125,6 +336,20 @@ void naettPlatformCloseResponse(InternalResponse* res);
 #include <stddef.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#if !__WINDOWS__
+#include <time.h>
+#endif
+
+// Define NAETT_NO_SIMD to use the scalar header parser.
+#if !defined(NAETT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define naettSSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
 
 typedef struct InternalParam* InternalParamPtr;
 typedef void (*ParamSetter)(InternalParamPtr param, InternalRequest* req);
@@ -134,6 +359,7 @@ typedef struct InternalParam {
         int offset;
         union {
             int integer;
+            long long integer64;
             const char* string;
             struct {
                 const char* key;
@@ -166,45 +392,54 @@ static void intSetter(InternalParamPtr param, InternalRequest* req) {
     *intField = param->integer;
 }
 
+static void int64Setter(InternalParamPtr param, InternalRequest* req) {
+    char* opaque = (char*)&req->options;
+    long long* intField = (long long*)(opaque + param->offset);
+    *intField = param->integer64;
+}
+
 static void ptrSetter(InternalParamPtr param, InternalRequest* req) {
     char* opaque = (char*)&req->options;
     void** ptrField = (void**)(opaque + param->offset);
     *ptrField = param->ptr;
 }
 
+static void addKV(KVLink** list, const char* key, const char* value) {
+    naettAlloc(KVLink, newNode);
+    newNode->key = strdup(key);
+    newNode->value = strdup(value);
+    newNode->next = *list;
+
+    *list = newNode;
+}
+
 static void kvSetter(InternalParamPtr param, InternalRequest* req) {
     char* opaque = (char*)&req->options;
     KVLink** kvField = (KVLink**)(opaque + param->offset);
-
-    naettAlloc(KVLink, newNode);
-    newNode->key = strdup(param->kv.key);
-    newNode->value = strdup(param->kv.value);
-    newNode->next = *kvField;
-
-    *kvField = newNode;
+    addKV(kvField, param->kv.key, param->kv.value);
 }
 
-static int defaultBodyReader(void* dest, int bufferSize, void* userData) {
+static long long defaultBodyReader(void* dest, long long bufferSize, void* userData) {
     Buffer* buffer = (Buffer*) userData;
 
     if (dest == NULL) {
         return buffer->size;
     }
 
-    int bytesToRead = buffer->size - buffer->position;
+    long long bytesToRead = buffer->size - buffer->position;
     if (bytesToRead > bufferSize) {
         bytesToRead = bufferSize;
     }
 
     const char* source = ((const char*)buffer->data) + buffer->position;
-    memcpy(dest, source, bytesToRead);
+    memcpy(dest, source, (size_t)bytesToRead);
     buffer->position += bytesToRead;
     return bytesToRead;
 }
 
-static int defaultBodyWriter(const void* source, int bytes, void* userData) {
+static long long defaultBodyWriter(const void* source, long long bytes, void* userData) {
     Buffer* buffer = (Buffer*) userData;
-    int newCapacity = buffer->capacity;
+    long long newCapacity = buffer->capacity;
     if (newCapacity == 0) {
         newCapacity = bytes;
     }
@@ -212,22 +447,104 @@ static int defaultBodyWriter(const void* source, int bytes, void* userData) {
         newCapacity *= 2;
     }
     if (newCapacity != buffer->capacity) {
-        buffer->data = realloc(buffer->data, newCapacity);
+        if ((unsigned long long)newCapacity > SIZE_MAX) {
+            return 0;
+        }
+        void* data = realloc(buffer->data, (size_t)newCapacity);
+        if (data == NULL) {
+            return 0;
+        }
+        buffer->data = data;
         buffer->capacity = newCapacity;
     }
     char* dest = ((char*)buffer->data) + buffer->size;
-    memcpy(dest, source, bytes);
+    memcpy(dest, source, (size_t)bytes);
     buffer->size += bytes;
     return bytes;
 }
 
+static void reserveBody(Buffer* buffer, long long capacity) {
+    if (capacity <= buffer->capacity || (unsigned long long)capacity > SIZE_MAX) {
+        return;
+    }
+    void* data = realloc(buffer->data, (size_t)capacity);
+    if (data != NULL) {
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
 static int initialized = 0;
+static InternalClient* defaultClient = NULL;
+
+// Signalled on every completion while `naettWaitAny` waits on responses of several clients.
+static naettMutex crossClientLock;
+static naettCond crossClientSignal;
+static int numCrossClientWaiters = 0;
 
 static void initRequest(InternalRequest* req, const char* url) {
     assert(initialized);
     req->options.method = strdup("GET");
-    req->options.timeoutMS = 5000;
+    req->options.timeoutMS = -1;
     req->url = strdup(url);
+    req->refCount = (int*)malloc(sizeof(int));
+    *req->refCount = 1;
+}
+
+static void applyClientDefaults(InternalRequest* req) {
+    if (req->options.client == NULL) {
+        req->options.client = defaultClient;
+    }
+    const naettConfig* config = &req->options.client->config;
+    if (req->options.timeoutMS < 0) {
+        req->options.timeoutMS = config->timeoutMS;
+    }
+    if (req->options.deadlineMS == 0) {
+        req->options.deadlineMS = config->deadlineMS;
+    }
+    if (req->options.firstByteTimeoutMS == 0) {
+        req->options.firstByteTimeoutMS = config->firstByteTimeoutMS;
+    }
+    if (req->options.idleTimeoutMS == 0) {
+        req->options.idleTimeoutMS = config->idleTimeoutMS;
+    }
+    if (req->options.lowSpeedSeconds == 0) {
+        req->options.lowSpeedBytesPerSecond = config->lowSpeedBytesPerSecond;
+        req->options.lowSpeedSeconds = config->lowSpeedSeconds;
+    }
+    if (req->options.httpVersion == naettHTTPDefault) {
+        req->options.httpVersion = config->httpVersion;
+    }
+    if (req->options.userAgent == NULL && config->userAgent != NULL) {
+        req->options.userAgent = strdup(config->userAgent);
+    }
+}
+
+static InternalClient* createClient(const naettConfig* config) {
+    naettAlloc(InternalClient, client);
+    client->config = *config;
+    naettMutexInit(&client->admissionLock);
+    naettMutexInit(&client->completionLock);
+    naettCondInit(&client->completionSignal);
+    if (client->config.timeoutMS <= 0) {
+        client->config.timeoutMS = 5000;
+    }
+    if (client->config.maxBodyPreallocation == 0) {
+        client->config.maxBodyPreallocation = 1024 * 1024;
+    }
+    if (config->userAgent != NULL) {
+        client->config.userAgent = strdup(config->userAgent);
+    }
+
+    if (!naettPlatformInitClient(client)) {
+        naettMutexDestroy(&client->admissionLock);
+        naettMutexDestroy(&client->completionLock);
+        naettCondDestroy(&client->completionSignal);
+        free((void*)client->config.userAgent);
+        free(client);
+        return NULL;
+    }
+    return client;
 }
 
 static void applyOptionParams(InternalRequest* req, InternalOption* option) {
@@ -237,14 +554,316 @@ static void applyOptionParams(InternalRequest* req, InternalOption* option) {
     }
 }
 
+static void completeResponses(InternalResponse* first, int notify);
+
+// Takes an admission slot for a response, or queues it when all slots are taken.
+// Returns 1 if the request should be made right away. When the queue is full too,
+// the response is completed with `naettWouldBlockError`, without calling its
+// completion callback, as the caller has not even got the response yet.
+static int admitResponse(InternalClient* client, InternalResponse* res) {
+    if (client->config.maxActive <= 0) {
+        return 1;
+    }
+
+    // Once admitted, the response may complete and release its slot at any time.
+    int admitted = 0;
+    int admitNow = 0;
+    naettMutexLock(&client->admissionLock);
+    if (client->numActive < client->config.maxActive) {
+        client->numActive++;
+        res->admitted = 1;
+        admitted = 1;
+        admitNow = 1;
+    } else if (client->numQueued < client->config.maxQueued) {
+        res->nextQueued = NULL;
+        res->prevQueued = client->lastQueued;
+        if (client->lastQueued) {
+            client->lastQueued->nextQueued = res;
+        } else {
+            client->firstQueued = res;
+        }
+        client->lastQueued = res;
+        client->numQueued++;
+        naettAtomicStore(&res->queued, 1);
+        res->admitted = 1;
+        admitted = 1;
+    }
+    naettMutexUnlock(&client->admissionLock);
+
+    if (!admitted) {
+        res->code = naettWouldBlockError;
+        res->nextCompleted = NULL;
+        completeResponses(res, 0);
+    }
+    return admitNow;
+}
+
+// Removes a response from the admission queue of its client. Must be called with
+// `admissionLock` held.
+static void unlinkQueued(InternalClient* client, InternalResponse* res) {
+    if (res->prevQueued) {
+        res->prevQueued->nextQueued = res->nextQueued;
+    } else {
+        client->firstQueued = res->nextQueued;
+    }
+    if (res->nextQueued) {
+        res->nextQueued->prevQueued = res->prevQueued;
+    } else {
+        client->lastQueued = res->prevQueued;
+    }
+    res->nextQueued = NULL;
+    res->prevQueued = NULL;
+    client->numQueued--;
+    naettAtomicStore(&res->queued, 0);
+}
+
+// Hands the admission slot of a completed response over to the oldest queued response.
+static void releaseAdmission(InternalResponse* res) {
+    if (!res->admitted) {
+        return;
+    }
+    res->admitted = 0;
+
+    InternalClient* client = res->request->options.client;
+    naettMutexLock(&client->admissionLock);
+    InternalResponse* next = client->firstQueued;
+    if (next) {
+        unlinkQueued(client, next);
+    } else {
+        client->numActive--;
+    }
+    naettMutexUnlock(&client->admissionLock);
+
+    if (next) {
+        naettPlatformMakeRequest(next);
+    }
+}
+
+// Takes a response out of the admission queue of its client, giving up its place.
+// Returns 0 if it was not queued.
+static int unqueueAdmission(InternalResponse* res) {
+    // A response is only ever queued by `naettMake`, before the caller gets it,
+    // so one found unqueued here stays that way.
+    if (!naettAtomicLoad(&res->queued)) {
+        return 0;
+    }
+
+    InternalClient* client = res->request->options.client;
+    int found = 0;
+
+    naettMutexLock(&client->admissionLock);
+    if (res->queued) {
+        unlinkQueued(client, res);
+        res->admitted = 0;
+        found = 1;
+    }
+    naettMutexUnlock(&client->admissionLock);
+    return found;
+}
+
+static int isQueuedCompletion(InternalClient* client, InternalResponse* res) {
+    return res->prevCompleted != NULL || client->firstCompleted == res;
+}
+
+static void dequeueCompletion(InternalClient* client, InternalResponse* res) {
+    if (res->prevCompleted) {
+        res->prevCompleted->nextCompleted = res->nextCompleted;
+    } else {
+        client->firstCompleted = res->nextCompleted;
+    }
+    if (res->nextCompleted) {
+        res->nextCompleted->prevCompleted = res->prevCompleted;
+    } else {
+        client->lastCompleted = res->prevCompleted;
+    }
+    res->nextCompleted = NULL;
+    res->prevCompleted = NULL;
+}
+
+static void enqueueCompletion(InternalClient* client, InternalResponse* res) {
+    if (client->firstCompleted == NULL) {
+        naettPlatformSignalCompletion(client, 1);
+    }
+    res->nextCompleted = NULL;
+    res->prevCompleted = client->lastCompleted;
+    if (client->lastCompleted) {
+        client->lastCompleted->nextCompleted = res;
+    } else {
+        client->firstCompleted = res;
+    }
+    client->lastCompleted = res;
+}
+
+static void freeResponse(InternalResponse* res);
+
+// Runs the completion callback of a response, if there is one.
+// Returns 0 if the response was closed by the callback.
+static int notifyCompletion(InternalResponse* res) {
+    RequestOptions* options = &res->request->options;
+    if (options->onComplete == NULL) {
+        return 1;
+    }
+
+    if (!naettAtomicCAS(&res->closeState, 0, naettInCallback)) {
+        // Being closed, and waited for by `naettClose`
+        return 1;
+    }
+    options->onComplete((naettRes*)res, res->code, options->onCompleteData);
+
+    if (!naettAtomicCAS(&res->closeState, naettInCallback, 0)) {
+        // Closed by the callback, or by another thread while it ran
+        freeResponse(res);
+        return 0;
+    }
+    return 1;
+}
+
+static void completeResponses(InternalResponse* first, int notify) {
+    InternalResponse* remaining = NULL;
+    InternalResponse** link = &remaining;
+
+    InternalResponse* res = first;
+    while (res != NULL) {
+        InternalResponse* next = res->nextCompleted;
+        // Too late to cancel from here on
+        naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing);
+        releaseAdmission(res);
+        if (!notify || notifyCompletion(res)) {
+            *link = res;
+            link = &res->nextCompleted;
+        }
+        res = next;
+    }
+    *link = NULL;
+
+    if (remaining == NULL) {
+        return;
+    }
+
+    // Batches normally hold responses of a single client, which is locked once.
+    InternalClient* locked = NULL;
+    res = remaining;
+    while (res != NULL) {
+        InternalResponse* next = res->nextCompleted;
+        InternalClient* client = res->request->options.client;
+        if (client != locked) {
+            if (locked != NULL) {
+                naettCondBroadcast(&locked->completionSignal);
+                naettMutexUnlock(&locked->completionLock);
+            }
+            naettMutexLock(&client->completionLock);
+            locked = client;
+        }
+        naettAtomicStore(&res->complete, 1);
+        res->nextCompleted = NULL;
+        // Responses with callbacks are only waited for, never collected.
+        if (res->request->options.onComplete == NULL) {
+            enqueueCompletion(client, res);
+        }
+        res = next;
+    }
+    naettCondBroadcast(&locked->completionSignal);
+    naettMutexUnlock(&locked->completionLock);
+
+    // Pairs with the increment in `naettWaitAny`, so either the waiter sees the
+    // responses complete, or the completion sees the waiter.
+    if (naettAtomicLoad(&numCrossClientWaiters) > 0) {
+        naettMutexLock(&crossClientLock);
+        naettCondBroadcast(&crossClientSignal);
+        naettMutexUnlock(&crossClientLock);
+    }
+}
+
+void naettCompleteResponses(InternalResponse* first) {
+    completeResponses(first, 1);
+}
+
+void naettCompleteResponse(InternalResponse* res) {
+    if (naettAtomicLoad(&res->complete)) {
+        return;
+    }
+    res->nextCompleted = NULL;
+    naettCompleteResponses(res);
+}
+
+static int findCompleted(naettRes** responses, int numResponses) {
+    for (int i = 0; i < numResponses; i++) {
+        if (naettAtomicLoad(&((InternalResponse*)responses[i])->complete)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static long long currentTimeMS(void) {
+#if __WINDOWS__
+    return (long long)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+// Waits for a completion signal for at most `timeoutMS`, or forever if negative.
+// Must be called with `lock` held.
+static void waitForCompletionSignal(naettCond* signal, naettMutex* lock, int timeoutMS) {
+#if __WINDOWS__
+    DWORD waitMS = timeoutMS < 0 ? INFINITE : (DWORD)timeoutMS;
+    SleepConditionVariableSRW(signal, lock, waitMS, 0);
+#else
+    if (timeoutMS < 0) {
+        pthread_cond_wait(signal, lock);
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMS / 1000;
+    deadline.tv_nsec += (long)(timeoutMS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(signal, lock, &deadline);
+#endif
+}
+
 // Public API
 
 void naettInit(naettInitData initData) {
+    naettConfig config = { 0 };
+    naettInitWithConfig(initData, &config);
+}
+
+void naettInitWithConfig(naettInitData initData, const naettConfig* config) {
     assert(!initialized);
+    assert(config != NULL);
+    naettMutexInit(&crossClientLock);
+    naettCondInit(&crossClientSignal);
     naettPlatformInit(initData);
+    defaultClient = createClient(config);
+    assert(defaultClient != NULL);
     initialized = 1;
 }
 
+naettClient* naettClientCreate(const naettConfig* config) {
+    assert(initialized);
+    assert(config != NULL);
+    return (naettClient*)createClient(config);
+}
+
+void naettClientFree(naettClient* client) {
+    assert(client != NULL);
+    InternalClient* cli = (InternalClient*)client;
+    assert(cli != defaultClient);
+    naettPlatformFreeClient(cli);
+    naettMutexDestroy(&cli->admissionLock);
+    naettMutexDestroy(&cli->completionLock);
+    naettCondDestroy(&cli->completionSignal);
+    free((void*)cli->config.userAgent);
+    free(cli);
+}
+
 naettOption* naettMethod(const char* method) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -282,6 +901,30 @@ naettOption* naettUserAgent(const char* userAgent) {
     return (naettOption*)option;
 }
 
+naettOption* naettHTTPVersion(int version) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = version;
+    param->offset = offsetof(RequestOptions, httpVersion);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettUseClient(naettClient* client) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->ptr = client;
+    param->offset = offsetof(RequestOptions, client);
+    param->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettTimeout(int timeoutMS) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -294,7 +937,65 @@ naettOption* naettTimeout(int timeoutMS) {
     return (naettOption*)option;
 }
 
+naettOption* naettDeadline(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, deadlineMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettFirstByteTimeout(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, firstByteTimeoutMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettIdleTimeout(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, idleTimeoutMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettLowSpeed(int bytesPerSecond, int seconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* speedParam = &option->params[0];
+    InternalParam* timeParam = &option->params[1];
+
+    speedParam->integer = bytesPerSecond;
+    speedParam->offset = offsetof(RequestOptions, lowSpeedBytesPerSecond);
+    speedParam->setter = intSetter;
+
+    timeParam->integer = seconds;
+    timeParam->offset = offsetof(RequestOptions, lowSpeedSeconds);
+    timeParam->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettBody(const char* body, int size) {
+    return naettBody64(body, size);
+}
+
+naettOption* naettBody64(const char* body, long long size) {
     naettAlloc(InternalOption, option);
     option->numParams = 2;
 
@@ -305,9 +1006,9 @@ naettOption* naettBody(const char* body, int size) {
     bodyParam->offset = offsetof(RequestOptions, body) + offsetof(Buffer, data);
     bodyParam->setter = ptrSetter;
 
-    sizeParam->integer = size;
+    sizeParam->integer64 = size;
     sizeParam->offset = offsetof(RequestOptions, body) + offsetof(Buffer, size);
-    sizeParam->setter = intSetter;
+    sizeParam->setter = int64Setter;
 
     return (naettOption*)option;
 }
@@ -330,6 +1031,42 @@ naettOption* naettBodyReader(naettReadFunc reader, void* userData) {
     return (naettOption*)option;
 }
 
+naettOption* naettBodyReader64(naettReadFunc64 reader, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* readerParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    readerParam->func = (void (*)(void)) reader;
+    readerParam->offset = offsetof(RequestOptions, bodyReader64);
+    readerParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, bodyReaderData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettOnComplete(naettCompleteFunc callback, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* callbackParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    callbackParam->func = (void (*)(void)) callback;
+    callbackParam->offset = offsetof(RequestOptions, onComplete);
+    callbackParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, onCompleteData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     naettAlloc(InternalOption, option);
     option->numParams = 2;
@@ -348,21 +1085,67 @@ naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     return (naettOption*)option;
 }
 
-void setupDefaultRW(InternalRequest* req) {
-    if (req->options.bodyReader == NULL) {
-        req->options.bodyReader = defaultBodyReader;
-        req->options.bodyReaderData = (void*) &req->options.body;
-    }
-    if (req->options.bodyReader == defaultBodyReader) {
-        req->options.body.position = 0;
-    }
-    if (req->options.bodyWriter == NULL) {
-        req->options.bodyWriter = defaultBodyWriter;
-    }
-}
+naettOption* naettBodyWriter64(naettWriteFunc64 writer, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
 
-naettReq* naettRequest_va(const char* url, int numArgs, ...) {
-    assert(url != NULL);
+    InternalParam* writerParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    writerParam->func = (void(*)(void)) writer;
+    writerParam->offset = offsetof(RequestOptions, bodyWriter64);
+    writerParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, bodyWriterData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
+void setupDefaultRW(InternalRequest* req) {
+    if (req->options.bodyReader == NULL && req->options.bodyReader64 == NULL) {
+        req->options.bodyReader64 = defaultBodyReader;
+        req->options.bodyReaderData = (void*) &req->options.body;
+    }
+    if (req->options.bodyReader64 == defaultBodyReader) {
+        req->options.body.position = 0;
+    }
+    if (req->options.bodyWriter == NULL && req->options.bodyWriter64 == NULL) {
+        req->options.bodyWriter64 = defaultBodyWriter;
+    }
+}
+
+long long naettReadBody(const InternalRequest* req, void* readerData, void* dest, long long bufferSize) {
+    if (req->options.bodyReader64 != NULL) {
+        return req->options.bodyReader64(dest, bufferSize, readerData);
+    }
+    return req->options.bodyReader(dest, bufferSize > INT_MAX ? INT_MAX : (int)bufferSize, readerData);
+}
+
+long long naettWriteBody(const InternalRequest* req, void* writerData, const void* source, long long bytes) {
+    if (req->options.bodyWriter64 != NULL) {
+        return req->options.bodyWriter64(source, bytes, writerData);
+    }
+    // Chunks from the platform are far below 2 GiB
+    return req->options.bodyWriter(source, (int)bytes, writerData);
+}
+
+// Applies defaults and initializes the platform part of a configured request.
+static naettReq* finishRequest(InternalRequest* req) {
+    applyClientDefaults(req);
+    setupDefaultRW(req);
+
+    if (naettPlatformInitRequest(req)) {
+        return (naettReq*)req;
+    }
+
+    naettFree((naettReq*) req);
+    return NULL;
+}
+
+naettReq* naettRequest_va(const char* url, int numArgs, ...) {
+    assert(url != NULL);
 
     va_list args;
     InternalOption* option;
@@ -377,14 +1160,7 @@ naettReq* naettRequest_va(const char* url, int numArgs, ...) {
     }
     va_end(args);
 
-    setupDefaultRW(req);
-
-    if (naettPlatformInitRequest(req)) {
-        return (naettReq*)req;
-    }
-
-    naettFree((naettReq*) req);
-    return NULL;
+    return finishRequest(req);
 }
 
 naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOption** options) {
@@ -400,9 +1176,71 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
         free(option);
     }
 
-    setupDefaultRW(req);
+    return finishRequest(req);
+}
 
-    if (naettPlatformInitRequest(req)) {
+naettReq* naettRequestWithConfig(const char* url, const naettRequestConfig* config) {
+    assert(url != NULL);
+    assert(config != NULL);
+    assert(config->numHeaders == 0 || config->headers != NULL);
+
+    naettAlloc(InternalRequest, req);
+    initRequest(req, url);
+    RequestOptions* options = &req->options;
+
+    if (config->method != NULL) {
+        free((void*)options->method);
+        options->method = strdup(config->method);
+    }
+    if (config->userAgent != NULL) {
+        options->userAgent = strdup(config->userAgent);
+    }
+    for (int i = 0; i < config->numHeaders; i++) {
+        addKV(&options->headers, config->headers[i].name, config->headers[i].value);
+    }
+    options->body.data = (void*)config->body;
+    options->body.size = config->bodySize;
+    options->bodyReader = config->bodyReader;
+    options->bodyReader64 = config->bodyReader64;
+    options->bodyReaderData = config->bodyReaderData;
+    options->bodyWriter = config->bodyWriter;
+    options->bodyWriter64 = config->bodyWriter64;
+    options->bodyWriterData = config->bodyWriterData;
+    options->onComplete = config->onComplete;
+    options->onCompleteData = config->onCompleteData;
+    if (config->timeoutMS > 0) {
+        options->timeoutMS = config->timeoutMS;
+    }
+    options->deadlineMS = config->deadlineMS;
+    options->firstByteTimeoutMS = config->firstByteTimeoutMS;
+    options->idleTimeoutMS = config->idleTimeoutMS;
+    options->lowSpeedBytesPerSecond = config->lowSpeedBytesPerSecond;
+    options->lowSpeedSeconds = config->lowSpeedSeconds;
+    options->httpVersion = config->httpVersion;
+    options->client = (InternalClient*)config->client;
+
+    return finishRequest(req);
+}
+
+naettReq* naettReqClone(naettReq* request, const char* url) {
+    assert(request != NULL);
+    assert(url != NULL);
+
+    InternalRequest* source = (InternalRequest*)request;
+    naettAlloc(InternalRequest, req);
+
+    // Options are already resolved, including client defaults. Their strings never
+    // change after creation, so they are shared rather than copied.
+    req->options = source->options;
+    req->options.body.position = 0;
+    if (req->options.bodyReader64 == defaultBodyReader) {
+        req->options.bodyReaderData = (void*) &req->options.body;
+    }
+    req->refCount = source->refCount;
+    naettAtomicAdd(req->refCount, 1);
+    req->url = strdup(url);
+
+    if (naettPlatformCloneRequest(req, source)) {
         return (naettReq*)req;
     }
 
@@ -410,23 +1248,92 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
     return NULL;
 }
 
-naettRes* naettMake(naettReq* request) {
-    assert(initialized);
+int naettSetURL(naettReq* request, const char* url) {
     assert(request != NULL);
+    assert(url != NULL);
 
     InternalRequest* req = (InternalRequest*)request;
+    const char* previousURL = req->url;
+    req->url = strdup(url);
+
+    if (!naettPlatformSetURL(req)) {
+        free((void*)req->url);
+        req->url = previousURL;
+        return 0;
+    }
+    free((void*)previousURL);
+    return 1;
+}
+
+static InternalResponse* createResponse(InternalRequest* req) {
     naettAlloc(InternalResponse, res);
     res->request = req;
 
-    if (req->options.bodyWriter == defaultBodyWriter) {
-        req->options.bodyWriterData = (void*) &res->body;
+    res->bodyReaderData = req->options.bodyReaderData;
+    if (req->options.bodyReader64 == defaultBodyReader) {
+        res->requestBody = req->options.body;
+        res->requestBody.position = 0;
+        res->bodyReaderData = (void*) &res->requestBody;
+    }
+    res->bodyWriterData = req->options.bodyWriterData;
+    if (req->options.bodyWriter64 == defaultBodyWriter) {
+        res->bodyWriterData = (void*) &res->body;
     }
+    return res;
+}
+
+naettRes* naettMake(naettReq* request) {
+    assert(initialized);
+    assert(request != NULL);
+
+    InternalRequest* req = (InternalRequest*)request;
+    InternalResponse* res = createResponse(req);
 
-    naettPlatformMakeRequest(res);
+    if (admitResponse(req->options.client, res)) {
+        naettPlatformMakeRequest(res);
+    }
     return (naettRes*) res;
 }
 
+void naettMakeBatch(naettReq** requests, int numRequests, naettRes** responses) {
+    assert(initialized);
+    assert(numRequests == 0 || (requests != NULL && responses != NULL));
+
+    InternalResponse* batch = NULL;
+    InternalResponse** link = &batch;
+
+    for (int i = 0; i < numRequests; i++) {
+        assert(requests[i] != NULL);
+        InternalRequest* req = (InternalRequest*)requests[i];
+        InternalResponse* res = createResponse(req);
+        responses[i] = (naettRes*)res;
+
+        if (admitResponse(req->options.client, res)) {
+            *link = res;
+            link = &res->nextQueued;
+        }
+    }
+    *link = NULL;
+
+    if (batch != NULL) {
+        naettPlatformMakeRequests(batch);
+    }
+}
+
+static int clampSize(long long size) {
+    return size > INT_MAX ? INT_MAX : (int)size;
+}
+
 const void* naettGetBody(naettRes* response, int* size) {
+    assert(size != NULL);
+
+    long long size64 = 0;
+    const void* body = naettGetBody64(response, &size64);
+    *size = clampSize(size64);
+    return body;
+}
+
+const void* naettGetBody64(naettRes* response, long long* size) {
     assert(response != NULL);
     assert(size != NULL);
 
@@ -436,6 +1343,15 @@ const void* naettGetBody(naettRes* response, int* size) {
 }
 
 int naettGetTotalBytesRead(naettRes* response, int* totalSize) {
+    assert(totalSize != NULL);
+
+    long long totalSize64 = 0;
+    long long bytesRead = naettGetTotalBytesRead64(response, &totalSize64);
+    *totalSize = clampSize(totalSize64);
+    return clampSize(bytesRead);
+}
+
+long long naettGetTotalBytesRead64(naettRes* response, long long* totalSize) {
     assert(response != NULL);
     assert(totalSize != NULL);
 
@@ -444,32 +1360,286 @@ int naettGetTotalBytesRead(naettRes* response, int* totalSize) {
     return res->totalBytesRead;
 }
 
-const char* naettGetHeader(naettRes* response, const char* name) {
+// Fits the typical set of response headers in one block.
+#define arenaBlockSize 2048
+#define arenaAlign(SIZE) (((SIZE) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+void* naettArenaAlloc(Arena* arena, size_t size) {
+    size = arenaAlign(size);
+    ArenaBlock* block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = block != NULL ? block->size * 2 : arenaBlockSize;
+        while (blockSize < size) {
+            blockSize *= 2;
+        }
+        ArenaBlock* newBlock = (ArenaBlock*)malloc(arenaAlign(sizeof(ArenaBlock)) + blockSize);
+        if (newBlock == NULL) {
+            return NULL;
+        }
+        newBlock->next = block;
+        newBlock->size = blockSize;
+        newBlock->used = 0;
+        arena->blocks = block = newBlock;
+    }
+    void* result = (char*)block + arenaAlign(sizeof(ArenaBlock)) + block->used;
+    block->used += size;
+    return result;
+}
+
+void naettArenaFree(Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+static unsigned int hashHeaderName(const char* name, size_t length) {
+    // FNV-1a over the ASCII lower case name
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+static int sameHeaderName(const HeaderEntry* entry, const char* name, size_t length, unsigned int hash) {
+    if (entry->hash != hash || entry->nameLength != length) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned char a = (unsigned char)entry->name[i];
+        unsigned char b = (unsigned char)name[i];
+        if (a != b && ((a | 0x20) != (b | 0x20) || (a | 0x20) < 'a' || (a | 0x20) > 'z')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void indexHeader(HeaderTable* table, int entryIndex) {
+    const HeaderEntry* entry = &table->entries[entryIndex];
+    unsigned int mask = (unsigned int)table->capacity * 2 - 1;
+    unsigned int slot = entry->hash & mask;
+    while (table->slots[slot] != 0 &&
+           !sameHeaderName(&table->entries[table->slots[slot] - 1], entry->name, entry->nameLength, entry->hash)) {
+        slot = (slot + 1) & mask;
+    }
+    // Later headers replace earlier ones of the same name
+    table->slots[slot] = entryIndex + 1;
+}
+
+static int growHeaderTable(Arena* arena, HeaderTable* table) {
+    int capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+    HeaderEntry* entries = (HeaderEntry*)naettArenaAlloc(arena, capacity * sizeof(HeaderEntry));
+    int* slots = (int*)naettArenaAlloc(arena, capacity * 2 * sizeof(int));
+    if (entries == NULL || slots == NULL) {
+        return 0;
+    }
+    if (table->count > 0) {
+        memcpy(entries, table->entries, table->count * sizeof(HeaderEntry));
+    }
+    memset(slots, 0, capacity * 2 * sizeof(int));
+    // The old arrays stay in the arena until the response is closed
+    table->entries = entries;
+    table->slots = slots;
+    table->capacity = capacity;
+    for (int i = 0; i < table->count; i++) {
+        indexHeader(table, i);
+    }
+    return 1;
+}
+
+void naettAddHeader(InternalResponse* res, const char* name, size_t nameLength, const char* value, size_t valueLength) {
+    HeaderTable* table = &res->headers;
+    if (table->count == table->capacity && !growHeaderTable(&res->arena, table)) {
+        return;
+    }
+    // Name and value in one piece
+    char* strings = (char*)naettArenaAlloc(&res->arena, nameLength + valueLength + 2);
+    if (strings == NULL) {
+        return;
+    }
+    memcpy(strings, name, nameLength);
+    strings[nameLength] = 0;
+    memcpy(strings + nameLength + 1, value, valueLength);
+    strings[nameLength + 1 + valueLength] = 0;
+
+    HeaderEntry* entry = &table->entries[table->count];
+    entry->name = strings;
+    entry->value = strings + nameLength + 1;
+    entry->nameLength = nameLength;
+    entry->hash = hashHeaderName(name, nameLength);
+    indexHeader(table, table->count++);
+}
+
+static void clearHeaders(HeaderTable* table) {
+    // Storage stays in the arena until the response is closed
+    if (table->capacity > 0) {
+        memset(table->slots, 0, table->capacity * 2 * sizeof(int));
+    }
+    table->count = 0;
+}
+
+static void foldHeader(InternalResponse* res, const char* value, size_t valueLength) {
+    HeaderTable* table = &res->headers;
+    if (table->count == 0 || valueLength == 0) {
+        return;
+    }
+    HeaderEntry* entry = &table->entries[table->count - 1];
+    size_t previousLength = strlen(entry->value);
+    char* folded = (char*)naettArenaAlloc(&res->arena, previousLength + valueLength + 2);
+    if (folded == NULL) {
+        return;
+    }
+    memcpy(folded, entry->value, previousLength);
+    folded[previousLength] = ' ';
+    memcpy(folded + previousLength + 1, value, valueLength);
+    folded[previousLength + 1 + valueLength] = 0;
+    entry->value = folded;
+}
+
+#if naettSSE2
+static int firstBit(int mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (int)index;
+#else
+    return __builtin_ctz((unsigned int)mask);
+#endif
+}
+#endif
+
+// Returns the offset of the first ':', CR or LF in `line`, or `length` if there is none.
+static size_t findHeaderDelimiter(const char* line, size_t length) {
+    size_t i = 0;
+#if naettSSE2
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(line + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, colon),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + firstBit(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        char c = line[i];
+        if (c == ':' || c == '\r' || c == '\n') {
+            return i;
+        }
+    }
+    return length;
+}
+
+static int isHeaderSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+int naettParseHeaderLine(InternalResponse* res, const char* line, size_t length) {
+    if (length == 0 || line[0] == '\r' || line[0] == '\n') {
+        // End of headers
+        return 1;
+    }
+    if (length >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        // Interim and redirect responses are followed by a new status line and headers
+        clearHeaders(&res->headers);
+        return 0;
+    }
+
+    const char* end = line + length;
+    while (end > line && (end[-1] == '\r' || end[-1] == '\n' || isHeaderSpace(end[-1]))) {
+        end--;
+    }
+
+    if (isHeaderSpace(line[0])) {
+        // Obsolete line folding, continues the previous header value
+        const char* value = line;
+        while (value < end && isHeaderSpace(*value)) {
+            value++;
+        }
+        foldHeader(res, value, end - value);
+        return 0;
+    }
+
+    size_t split = findHeaderDelimiter(line, end - line);
+    if (split == 0 || line + split == end || line[split] != ':') {
+        // Not a header
+        return 0;
+    }
+    const char* value = line + split + 1;
+    while (value < end && isHeaderSpace(*value)) {
+        value++;
+    }
+    naettAddHeader(res, line, split, value, end - value);
+    return 0;
+}
+
+void naettHeadersReceived(InternalResponse* res) {
+    const char* value = naettGetHeader((naettRes*)res, "Content-Length");
+    char* end = NULL;
+    long long length = value != NULL ? strtoll(value, &end, 10) : -1;
+    if (value == NULL || end == value || *end != 0 || length < 0 || length == LLONG_MAX) {
+        res->contentLength = -1;
+        return;
+    }
+    res->contentLength = length;
+
+    InternalRequest* req = res->request;
+    if (res->bodyWriterData == (void*)&res->body && strcmp(req->options.method, "HEAD") != 0) {
+        long long maxPreallocation = req->options.client->config.maxBodyPreallocation;
+        reserveBody(&res->body, maxPreallocation < res->contentLength ? maxPreallocation : res->contentLength);
+    }
+}
+
+const char* naettGetHeaderN(naettRes* response, const char* name, int nameLength) {
     assert(response != NULL);
     assert(name != NULL);
+    assert(nameLength >= 0);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (strcasecmp(name, node->key) == 0) {
-            return node->value;
+    const HeaderTable* table = &res->headers;
+    if (table->count == 0) {
+        return NULL;
+    }
+    unsigned int hash = hashHeaderName(name, nameLength);
+    unsigned int mask = (unsigned int)table->capacity * 2 - 1;
+    for (unsigned int slot = hash & mask; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const HeaderEntry* entry = &table->entries[table->slots[slot] - 1];
+        if (sameHeaderName(entry, name, nameLength, hash)) {
+            return entry->value;
         }
-        node = node->next;
     }
     return NULL;
 }
 
+const char* naettGetHeader(naettRes* response, const char* name) {
+    assert(name != NULL);
+    return naettGetHeaderN(response, name, (int)strlen(name));
+}
+
 void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userData) {
     assert(response != NULL);
     assert(lister != NULL);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (!lister(node->key, node->value, userData)) {
+    const HeaderTable* table = &res->headers;
+    // Latest first
+    for (int i = table->count - 1; i >= 0; i--) {
+        if (!lister(table->entries[i].name, table->entries[i].value, userData)) {
             return;
         }
-        node = node->next;
     }
 }
 
@@ -482,7 +1652,100 @@ naettReq* naettGetRequest(naettRes* response) {
 int naettComplete(const naettRes* response) {
     assert(response != NULL);
     InternalResponse* res = (InternalResponse*)response;
-    return res->complete;
+    return naettAtomicLoad(&res->complete);
+}
+
+int naettWait(naettRes* response, int timeoutMS) {
+    assert(response != NULL);
+    int index = 0;
+    return naettWaitAny(&response, 1, timeoutMS, &index);
+}
+
+int naettWaitAny(naettRes** responses, int numResponses, int timeoutMS, int* index) {
+    assert(initialized);
+    assert(responses != NULL);
+    assert(index != NULL);
+
+    long long deadline = currentTimeMS() + timeoutMS;
+
+    // Responses of a single client are waited for on its own signal.
+    InternalClient* client = NULL;
+    for (int i = 0; i < numResponses; i++) {
+        InternalClient* responseClient = ((InternalResponse*)responses[i])->request->options.client;
+        if (i > 0 && responseClient != client) {
+            client = NULL;
+            break;
+        }
+        client = responseClient;
+    }
+    naettMutex* lock = client ? &client->completionLock : &crossClientLock;
+    naettCond* signal = client ? &client->completionSignal : &crossClientSignal;
+    if (client == NULL) {
+        naettAtomicAdd(&numCrossClientWaiters, 1);
+    }
+
+    naettMutexLock(lock);
+    int found = findCompleted(responses, numResponses);
+    while (found < 0) {
+        int waitMS = -1;
+        if (timeoutMS >= 0) {
+            long long timeLeft = deadline - currentTimeMS();
+            if (timeLeft <= 0) {
+                break;
+            }
+            waitMS = (int)timeLeft;
+        }
+        waitForCompletionSignal(signal, lock, waitMS);
+        found = findCompleted(responses, numResponses);
+    }
+    naettMutexUnlock(lock);
+
+    if (client == NULL) {
+        naettAtomicAdd(&numCrossClientWaiters, -1);
+    }
+
+    if (found < 0) {
+        return 0;
+    }
+    *index = found;
+    return 1;
+}
+
+int naettClientCompletionFD(naettClient* client) {
+    assert(initialized);
+    assert(client != NULL);
+    return naettPlatformCompletionFD((InternalClient*)client);
+}
+
+int naettClientGetCompleted(naettClient* client, naettRes** responses, int maxResponses) {
+    assert(initialized);
+    assert(client != NULL);
+    assert(maxResponses == 0 || responses != NULL);
+    InternalClient* cli = (InternalClient*)client;
+
+    naettMutexLock(&cli->completionLock);
+    int count = 0;
+    while (count < maxResponses && cli->firstCompleted != NULL) {
+        InternalResponse* res = cli->firstCompleted;
+        dequeueCompletion(cli, res);
+        responses[count++] = (naettRes*)res;
+    }
+    if (count > 0 && cli->firstCompleted == NULL) {
+        naettPlatformSignalCompletion(cli, 0);
+    }
+    naettMutexUnlock(&cli->completionLock);
+
+    return count;
+}
+
+int naettCompletionFD(void) {
+    assert(initialized);
+    return naettClientCompletionFD((naettClient*)defaultClient);
+}
+
+int naettGetCompleted(naettRes** responses, int maxResponses) {
+    assert(initialized);
+    return naettClientGetCompleted((naettClient*)defaultClient, responses, maxResponses);
 }
 
 int naettGetStatus(const naettRes* response) {
@@ -506,23 +1769,70 @@ void naettFree(naettReq* request) {
 
     InternalRequest* req = (InternalRequest*)request;
     naettPlatformFreeRequest(req);
-    KVLink* node = req->options.headers;
-    freeKVList(node);
-    free((void*)req->options.method);
+    if (naettAtomicAdd(req->refCount, -1) == 0) {
+        naettPlatformFreeSharedRequest(req);
+        KVLink* node = req->options.headers;
+        freeKVList(node);
+        free((void*)req->options.method);
+        free((void*)req->options.userAgent);
+        free(req->refCount);
+    }
     free((void*)req->url);
     free(request);
 }
 
-void naettClose(naettRes* response) {
-    assert(response != NULL);
+static void freeResponse(InternalResponse* res) {
+    InternalClient* client = res->request->options.client;
+    naettMutexLock(&client->completionLock);
+    if (isQueuedCompletion(client, res)) {
+        dequeueCompletion(client, res);
+        if (client->firstCompleted == NULL) {
+            naettPlatformSignalCompletion(client, 0);
+        }
+    }
+    naettMutexUnlock(&client->completionLock);
 
-    InternalResponse* res = (InternalResponse*)response;
     res->request = NULL;
     naettPlatformCloseResponse(res);
-    KVLink* node = res->headers;
-    freeKVList(node);
+    naettArenaFree(&res->arena);
     free(res->body.data);
-    free(response);
+    free(res);
+}
+
+void naettCancel(naettRes* response) {
+    assert(response != NULL);
+
+    InternalResponse* res = (InternalResponse*)response;
+    // Completed responses are neither queued nor running, see `naettCompleteResponses`.
+    if (unqueueAdmission(res)) {
+        // Never started
+        res->code = naettCancelledError;
+        naettCompleteResponse(res);
+        return;
+    }
+    if (naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferCancelled)) {
+        naettPlatformCancelResponse(res);
+    }
+}
+
+void naettClose(naettRes* response) {
+    assert(response != NULL);
+
+    InternalResponse* res = (InternalResponse*)response;
+    for (;;) {
+        if (naettAtomicCAS(&res->closeState, naettInCallback, naettInCallback | naettClosing)) {
+            // The completion callback is running, and frees the response when it returns.
+            return;
+        }
+        if (naettAtomicCAS(&res->closeState, 0, naettClosing)) {
+            // From now on the completion callback is not called
+            break;
+        }
+    }
+    // If the platform still holds on to the response, wait until it lets go.
+    naettCancel(response);
+    naettWait(response, -1);
+    freeResponse(res);
 }
 // End of inlined naett_core.c //
 
@@ -664,15 +1974,15 @@ int naettPlatformInitRequest(InternalRequest* req) {
     }
 
     char byteBuffer[10240];
-    int bytesRead = 0;
+    long long bytesRead = 0;
 
-    if (req->options.bodyReader != NULL) {
+    if (req->options.bodyReader != NULL || req->options.bodyReader64 != NULL) {
         id bodyData =
             objc_msgSend_t(id, NSUInteger)(class("NSMutableData"), sel("dataWithCapacity:"), sizeof(byteBuffer));
 
-        int totalBytesRead = 0;
+        long long totalBytesRead = 0;
         do {
-            bytesRead = req->options.bodyReader(byteBuffer, sizeof(byteBuffer), req->options.bodyReaderData);
+            bytesRead = naettReadBody(req, req->options.bodyReaderData, byteBuffer, sizeof(byteBuffer));
             totalBytesRead += bytesRead;
             objc_msgSend_t(void, const void*, NSUInteger)(bodyData, sel("appendBytes:length:"), byteBuffer, bytesRead);
         } while (bytesRead > 0);
@@ -695,7 +2005,7 @@ void didReceiveData(id self, SEL _sel, id session, id dataTask, id data) {
 
     object_getInstanceVariable(self, "response", (void**)&res);
 
-    if (res->headers == NULL) {
+    if (res->headers.count == 0) {
         id response = objc_msgSend_t(id)(dataTask, sel("response"));
         res->code = objc_msgSend_t(NSInteger)(response, sel("statusCode"));
         id allHeaders = objc_msgSend_t(id)(response, sel("allHeaderFields"));
@@ -706,27 +2016,20 @@ void didReceiveData(id self, SEL _sel, id session, id dataTask, id data) {
 
         objc_msgSend_t(NSInteger, id*, id*, NSUInteger)(
             allHeaders, sel("getObjects:andKeys:count:"), headerValues, headerNames, headerCount);
-        KVLink* firstHeader = NULL;
         for (int i = 0; i < headerCount; i++) {
-            naettAlloc(KVLink, node);
-            node->key = strdup(objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String")));
-            node->value = strdup(objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String")));
-            node->next = firstHeader;
-            firstHeader = node;
+            const char* name = objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String"));
+            const char* value = objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String"));
+            naettAddHeader(res, name, strlen(name), value, strlen(value));
         }
-        res->headers = firstHeader;
 
-        const char* contentLength = naettGetHeader((naettRes*)res, "Content-Length");
-        if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-            res->contentLength = -1;
-        }
+        naettHeadersReceived(res);
     }
 
     const void* bytes = objc_msgSend_t(const void*)(data, sel("bytes"));
     NSUInteger length = objc_msgSend_t(NSUInteger)(data, sel("length"));
 
-    res->request->options.bodyWriter(bytes, length, res->request->options.bodyWriterData);
-    res->totalBytesRead += (int)length;
+    naettWriteBody(res->request, res->bodyWriterData, bytes, length);
+    res->totalBytesRead += length;
 
     release(p);
 }
@@ -735,10 +2038,12 @@ static void didComplete(id self, SEL _sel, id session, id dataTask, id error) {
     InternalResponse* res = NULL;
     object_getInstanceVariable(self, "response", (void**)&res);
     if (res != NULL) {
-        if (error != nil) {
+        if (res->cancelState == naettTransferCancelled) {
+            res->code = naettCancelledError;
+        } else if (error != nil) {
             res->code = naettConnectionError;
         }
-        res->complete = 1;
+        naettCompleteResponse(res);
     }
 }
 
@@ -760,6 +2065,25 @@ static id createDelegate(void) {
     return delegate;
 }
 
+int naettPlatformSetURL(InternalRequest* req) {
+    id p = pool();
+
+    id urlString = NSString(req->url);
+    id url = objc_msgSend_t(id, id)(class("NSURL"), sel("URLWithString:"), urlString);
+    if (url != nil) {
+        objc_msgSend_t(void, id)(req->urlRequest, sel("setURL:"), url);
+    }
+
+    release(p);
+    return url != nil;
+}
+
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // The copy keeps the method, headers and body, and gets its own URL.
+    req->urlRequest = objc_msgSend_id(source->urlRequest, sel("mutableCopy"));
+    return naettPlatformSetURL(req);
+}
+
 void naettPlatformMakeRequest(InternalResponse* res) {
     InternalRequest* req = res->request;
     id p = pool();
@@ -788,119 +2112,611 @@ void naettPlatformFreeRequest(InternalRequest* req) {
     req->urlRequest = nil;
 }
 
-void naettPlatformCloseResponse(InternalResponse* res) {
-    objc_msgSend_void(res->session, sel("invalidateAndCancel"));
-    res->session = nil;
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
+void naettPlatformCloseResponse(InternalResponse* res) {
+    objc_msgSend_void(res->session, sel("invalidateAndCancel"));
+    res->session = nil;
+}
+
+void naettPlatformCancelResponse(InternalResponse* res) {
+    objc_msgSend_void(res->session, sel("invalidateAndCancel"));
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+}
+
+#endif  // __APPLE__
+// End of inlined naett_osx.c //
+
+// Inlined naett_linux.c: //
+//#include "naett_internal.h"
+
+#if __linux__ && !__ANDROID__
+
+#include <curl/curl.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+#define maxPooledHandles 64
+
+typedef struct Worker {
+    pthread_t thread;
+    CURLM* multi;
+    // Lock-free multi-producer, single-consumer stack of submitted responses.
+    // Producers push with a CAS, the worker takes the whole stack with one exchange.
+    InternalResponse* submissions;
+    // Responses to cancel, pushed the same way as submissions.
+    InternalResponse* cancellations;
+    // Cancellations that arrived before their submission. Only touched by the worker thread.
+    InternalResponse* deferredCancellations;
+    // Running transfers with timeouts checked by the worker. Only touched by the worker thread.
+    InternalResponse* timedTransfers;
+    // Set while a wakeup is pending, so that bursts of submissions only wake the worker once.
+    int wakeupPending;
+    int quit;
+    // Finished easy handles, reset and kept for reuse by new transfers.
+    // Only touched by the worker thread.
+    CURL* handlePool[maxPooledHandles];
+    int pooledHandles;
+} Worker;
+
+static void panic(const char* message) {
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+}
+
+static long long monotonicNS(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long long monotonicMS(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void wakeWorker(Worker* worker) {
+    if (!__atomic_exchange_n(&worker->wakeupPending, 1, __ATOMIC_SEQ_CST)) {
+        curl_multi_wakeup(worker->multi);
+    }
+}
+
+static void submit(Worker* worker, InternalResponse* first, InternalResponse* last) {
+    InternalResponse* head = __atomic_load_n(&worker->submissions, __ATOMIC_RELAXED);
+    do {
+        last->nextSubmitted = head;
+    } while (
+        !__atomic_compare_exchange_n(&worker->submissions, &head, first, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    wakeWorker(worker);
+}
+
+static void setupHandle(CURL* c, InternalResponse* res);
+
+static CURL* acquireHandle(Worker* worker) {
+    if (worker->pooledHandles > 0) {
+        return worker->handlePool[--worker->pooledHandles];
+    }
+    return curl_easy_init();
+}
+
+static void releaseHandle(Worker* worker, CURL* handle) {
+    if (worker->pooledHandles < maxPooledHandles) {
+        curl_easy_reset(handle);
+        worker->handlePool[worker->pooledHandles++] = handle;
+    } else {
+        curl_easy_cleanup(handle);
+    }
+}
+
+static void startTimers(Worker* worker, InternalResponse* res) {
+    RequestOptions* options = &res->request->options;
+    if (options->deadlineMS <= 0 && options->firstByteTimeoutMS <= 0 && options->idleTimeoutMS <= 0) {
+        return;
+    }
+
+    res->startMS = monotonicMS();
+    res->timed = 1;
+    res->prevTimed = NULL;
+    res->nextTimed = worker->timedTransfers;
+    if (worker->timedTransfers) {
+        worker->timedTransfers->prevTimed = res;
+    }
+    worker->timedTransfers = res;
+}
+
+static void addSubmitted(Worker* worker) {
+    __atomic_store_n(&worker->wakeupPending, 0, __ATOMIC_SEQ_CST);
+    InternalResponse* stack = __atomic_exchange_n(&worker->submissions, NULL, __ATOMIC_SEQ_CST);
+
+    // Reverse the stack to add handles in submission order
+    InternalResponse* queue = NULL;
+    while (stack != NULL) {
+        InternalResponse* next = stack->nextSubmitted;
+        stack->nextSubmitted = queue;
+        queue = stack;
+        stack = next;
+    }
+
+    while (queue != NULL) {
+        InternalResponse* next = queue->nextSubmitted;
+        queue->added = 1;
+        // Cancelled before it started, completed by cancelTransfers.
+        if (__atomic_load_n(&queue->cancelState, __ATOMIC_SEQ_CST) != naettTransferCancelled) {
+            CURL* handle = acquireHandle(worker);
+            setupHandle(handle, queue);
+            curl_multi_add_handle(worker->multi, handle);
+            queue->handle = handle;
+            queue->addedNS = monotonicNS();
+            startTimers(worker, queue);
+        }
+        queue = next;
+    }
+}
+
+static void removeTransfer(Worker* worker, InternalResponse* res) {
+    curl_multi_remove_handle(worker->multi, res->handle);
+    releaseHandle(worker, res->handle);
+    res->handle = NULL;
+
+    if (res->timed) {
+        if (res->prevTimed) {
+            res->prevTimed->nextTimed = res->nextTimed;
+        } else {
+            worker->timedTransfers = res->nextTimed;
+        }
+        if (res->nextTimed) {
+            res->nextTimed->prevTimed = res->prevTimed;
+        }
+        res->timed = 0;
+    }
+}
+
+// Returns 1 if `timeoutMS` has passed since `start`, otherwise lowers
+// `timeLeft` to the time until it does.
+static int timedOut(int timeoutMS, long long start, long long now, long long* timeLeft) {
+    if (timeoutMS <= 0) {
+        return 0;
+    }
+    long long left = start + timeoutMS - now;
+    if (left <= 0) {
+        return 1;
+    }
+    if (left < *timeLeft) {
+        *timeLeft = left;
+    }
+    return 0;
+}
+
+// Fails transfers whose deadline, first byte or idle timeout has passed, adding them
+// to `completed`. Returns the time in milliseconds until the next timeout.
+static int expireTransfers(Worker* worker, InternalResponse** completed) {
+    long long timeLeft = INT_MAX;
+    if (worker->timedTransfers == NULL) {
+        return (int)timeLeft;
+    }
+
+    long long now = monotonicMS();
+    InternalResponse* res = worker->timedTransfers;
+    while (res != NULL) {
+        InternalResponse* next = res->nextTimed;
+        RequestOptions* options = &res->request->options;
+
+        int code = 0;
+        if (timedOut(options->deadlineMS, res->startMS, now, &timeLeft)) {
+            code = naettDeadlineError;
+        } else if (!res->receivedData && timedOut(options->firstByteTimeoutMS, res->startMS, now, &timeLeft)) {
+            code = naettFirstByteTimeoutError;
+        } else if (res->receivedData && timedOut(options->idleTimeoutMS, res->lastReceiveMS, now, &timeLeft)) {
+            code = naettIdleTimeoutError;
+        }
+
+        // When cancelled meanwhile, the transfer is left to cancelTransfers.
+        if (code != 0 && naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing)) {
+            removeTransfer(worker, res);
+            res->code = code;
+            res->nextCompleted = *completed;
+            *completed = res;
+        }
+        res = next;
+    }
+    return (int)timeLeft;
+}
+
+// Stops cancelled transfers and returns their responses, linked through `nextCompleted`.
+// Cancelled responses are only completed here, so that they are not touched after completion.
+static InternalResponse* cancelTransfers(Worker* worker) {
+    InternalResponse* pending = __atomic_exchange_n(&worker->cancellations, NULL, __ATOMIC_SEQ_CST);
+    while (worker->deferredCancellations != NULL) {
+        InternalResponse* deferred = worker->deferredCancellations;
+        worker->deferredCancellations = deferred->nextCancelled;
+        deferred->nextCancelled = pending;
+        pending = deferred;
+    }
+
+    InternalResponse* cancelled = NULL;
+    while (pending != NULL) {
+        InternalResponse* next = pending->nextCancelled;
+        if (!pending->added) {
+            // Still on its way through the submission stack
+            pending->nextCancelled = worker->deferredCancellations;
+            worker->deferredCancellations = pending;
+        } else {
+            if (pending->handle != NULL) {
+                removeTransfer(worker, pending);
+            }
+            pending->code = naettCancelledError;
+            pending->nextCompleted = cancelled;
+            cancelled = pending;
+        }
+        pending = next;
+    }
+    return cancelled;
+}
+
+// Maps the result of a finished transfer to an HTTP status code or a `naettStatus` error.
+static int responseStatus(InternalResponse* res, CURLcode result) {
+    switch (result) {
+        case CURLE_OK: {
+            long responseCode = 0;
+            curl_easy_getinfo(res->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+            return (int)responseCode;
+        }
+        case CURLE_OPERATION_TIMEDOUT: {
+            // Only the connection and low speed timeouts are left to curl.
+            curl_off_t pretransferTime = 0;
+            curl_easy_getinfo(res->handle, CURLINFO_PRETRANSFER_TIME_T, &pretransferTime);
+            return pretransferTime > 0 ? naettLowSpeedError : naettConnectTimeoutError;
+        }
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_PEER_FAILED_VERIFICATION:
+            return naettConnectionError;
+        case CURLE_UNSUPPORTED_PROTOCOL:
+        case CURLE_URL_MALFORMAT:
+        case CURLE_WEIRD_SERVER_REPLY:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+        case CURLE_TOO_MANY_REDIRECTS:
+        case CURLE_GOT_NOTHING:
+            return naettProtocolError;
+        case CURLE_PARTIAL_FILE:
+        case CURLE_WRITE_ERROR:
+        case CURLE_RECV_ERROR:
+            return naettReadError;
+        case CURLE_READ_ERROR:
+        case CURLE_SEND_ERROR:
+            return naettWriteError;
+        default:
+            return naettGenericError;
+    }
+}
+
+static void* curlWorker(void* data) {
+    Worker* worker = (Worker*)data;
+    CURLM* mc = worker->multi;
+    int activeHandles = 0;
+    int messagesLeft = 0;
+
+    while (!__atomic_load_n(&worker->quit, __ATOMIC_SEQ_CST)) {
+        addSubmitted(worker);
+        InternalResponse* completed = cancelTransfers(worker);
+
+        int status = curl_multi_perform(mc, &activeHandles);
+        if (status != CURLM_OK) {
+            panic("CURL processing failure");
+        }
+
+        // Reap every finished transfer before marking the whole batch complete.
+        struct CURLMsg* message = NULL;
+        while ((message = curl_multi_info_read(mc, &messagesLeft)) != NULL) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            InternalResponse* res = NULL;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&res);
+            if (!naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing)) {
+                // Cancelled meanwhile, left to cancelTransfers
+                continue;
+            }
+
+            res->code = responseStatus(res, message->data.result);
+            removeTransfer(worker, res);
+
+            res->nextCompleted = completed;
+            completed = res;
+        }
+
+        int nextTimeout = expireTransfers(worker, &completed);
+
+        if (completed != NULL) {
+            naettCompleteResponses(completed);
+        }
+
+        // Sleep until there is socket activity, a curl timer or one of
+        // our timeouts expires, or a submission wakes us up.
+        status = curl_multi_poll(mc, NULL, 0, nextTimeout, NULL);
+        if (status != CURLM_OK) {
+            panic("CURL processing failure");
+        }
+    }
+
+    while (worker->pooledHandles > 0) {
+        curl_easy_cleanup(worker->handlePool[--worker->pooledHandles]);
+    }
+
+    return NULL;
+}
+
+// Whether HTTP/2 prior knowledge transfers may wait for a connection to multiplex on.
+// libcurl 7.x, at least up to 7.88, fails all but the first of them with CURLE_HTTP2.
+static int pipeWaitPriorKnowledge = 0;
+
+void naettPlatformInit(naettInitData initData) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    pipeWaitPriorKnowledge = curl_version_info(CURLVERSION_NOW)->version_num >= 0x080000;
+}
+
+static void stopWorker(Worker* worker) {
+    __atomic_store_n(&worker->quit, 1, __ATOMIC_SEQ_CST);
+    curl_multi_wakeup(worker->multi);
+    pthread_join(worker->thread, NULL);
+}
+
+static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userData) {
+    InternalClient* client = (InternalClient*)userData;
+    pthread_mutex_lock(&client->shareLocks[data]);
+}
+
+static void unlockShare(CURL* handle, curl_lock_data data, void* userData) {
+    InternalClient* client = (InternalClient*)userData;
+    pthread_mutex_unlock(&client->shareLocks[data]);
+}
+
+// Shares DNS resolutions and TLS sessions between all workers of a client.
+// Connections are not shared, libcurl does not support sharing them between
+// concurrently running multi handles. Each worker keeps its own connection cache.
+static int initShare(InternalClient* client) {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&client->shareLocks[i], NULL);
+    }
+
+    client->share = curl_share_init();
+    if (client->share == NULL) {
+        return 0;
+    }
+    curl_share_setopt(client->share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(client->share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(client->share, CURLSHOPT_USERDATA, client);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    return 1;
+}
+
+static void freeShare(InternalClient* client) {
+    if (client->share != NULL) {
+        curl_share_cleanup(client->share);
+        client->share = NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&client->shareLocks[i]);
+    }
 }
 
-#endif  // __APPLE__
-// End of inlined naett_osx.c //
-
-// Inlined naett_linux.c: //
-//#include "naett_internal.h"
+// Transfers over the connection limits are queued by libcurl until a
+// connection frees up. All requests to a host go to the same worker, so the
+// per-host limit holds as is, while the total limit is split between workers,
+// of which there are never more than connections allowed.
+static void setupMulti(CURLM* multi, const naettConfig* config, int workerIndex, int numWorkers) {
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (config->maxHostConnections > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)config->maxHostConnections);
+    }
+    if (config->maxConnections > 0) {
+        long maxConnections = config->maxConnections / numWorkers;
+        if (workerIndex < config->maxConnections % numWorkers) {
+            maxConnections++;
+        }
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, maxConnections);
+    }
+    if (config->maxConcurrentStreams > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)config->maxConcurrentStreams);
+    }
+    if (config->connectionCacheSize > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)config->connectionCacheSize);
+    }
+}
 
-#if __linux__ && !__ANDROID__
+int naettPlatformInitClient(InternalClient* client) {
+    client->completionFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (client->completionFD < 0) {
+        return 0;
+    }
+    if (!initShare(client)) {
+        freeShare(client);
+        close(client->completionFD);
+        return 0;
+    }
 
-#include <curl/curl.h>
-#include <assert.h>
-#include <pthread.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <string.h>
+    int numWorkers = client->config.workerThreads > 0 ? client->config.workerThreads : 1;
+    if (client->config.maxConnections > 0 && numWorkers > client->config.maxConnections) {
+        numWorkers = client->config.maxConnections;
+    }
+    client->workers = (Worker*)calloc(numWorkers, sizeof(Worker));
 
-static pthread_t workerThread;
-static int handleReadFD = 0;
-static int handleWriteFD = 0;
+    for (int i = 0; i < numWorkers; i++) {
+        Worker* worker = &client->workers[i];
+        worker->multi = curl_multi_init();
+        if (worker->multi != NULL) {
+            setupMulti(worker->multi, &client->config, i, numWorkers);
+        }
+        if (worker->multi == NULL || pthread_create(&worker->thread, NULL, curlWorker, worker) != 0) {
+            if (worker->multi != NULL) {
+                curl_multi_cleanup(worker->multi);
+            }
+            naettPlatformFreeClient(client);
+            return 0;
+        }
+        client->numWorkers++;
+    }
 
-static void panic(const char* message) {
-    fprintf(stderr, "%s\n", message);
-    exit(1);
+    return 1;
 }
 
-static void* curlWorker(void* data) {
-    CURLM* mc = (CURLM*)data;
-    int activeHandles = 0;
-    int messagesLeft = 1;
-
-    struct curl_waitfd readFd = { handleReadFD, CURL_WAIT_POLLIN };
+void naettPlatformFreeClient(InternalClient* client) {
+    for (int i = 0; i < client->numWorkers; i++) {
+        Worker* worker = &client->workers[i];
+        stopWorker(worker);
+        curl_multi_cleanup(worker->multi);
+    }
+    free(client->workers);
+    client->workers = NULL;
+    client->numWorkers = 0;
+    freeShare(client);
+    close(client->completionFD);
+    client->completionFD = -1;
+}
 
-    union {
-        CURL* handle;
-        char buf[sizeof(CURL*)];
-    } newHandle;
+// Hashes the scheme, host and port of the URL, so that all requests to the
+// same host end up on the same worker, where they can reuse connections.
+static unsigned int hashHost(const char* url) {
+    const char* separator = strstr(url, "://");
+    const char* host = separator ? separator + 3 : url;
+    const char* end = host + strcspn(host, "/?#");
 
-    int newHandlePos = 0;
+    unsigned int hash = 2166136261u;
+    for (const char* c = url; c < end; c++) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619u;
+    }
+    return hash;
+}
 
-    while (1) {
-        int status = curl_multi_perform(mc, &activeHandles);
-        if (status != CURLM_OK) {
-            panic("CURL processing failure");
-        }
+// Formats the header list once, so that requests can be made repeatedly without
+// rebuilding it.
+static struct curl_slist* buildHeaderList(InternalRequest* req) {
+    struct curl_slist* headerList = NULL;
+    char uaBuf[512];
+    snprintf(uaBuf, sizeof(uaBuf), "User-Agent: %s", req->options.userAgent ? req->options.userAgent : NAETT_UA);
+    headerList = curl_slist_append(headerList, uaBuf);
 
-        struct CURLMsg* message = curl_multi_info_read(mc, &messagesLeft);
-        if (message && message->msg == CURLMSG_DONE) {
-            CURL* handle = message->easy_handle;
-            InternalResponse* res = NULL;
-            curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char**)&res);
-            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &res->code);
-            res->complete = 1;
-            curl_easy_cleanup(handle);
+    KVLink* header = req->options.headers;
+    size_t bufferSize = 0;
+    char* buffer = NULL;
+    while (header) {
+        size_t headerLength = strlen(header->key) + strlen(header->value) + 1 + 1;  // colon + null
+        if (headerLength > bufferSize) {
+            bufferSize = headerLength;
+            buffer = (char*)realloc(buffer, bufferSize);
         }
+        snprintf(buffer, bufferSize, "%s:%s", header->key, header->value);
+        headerList = curl_slist_append(headerList, buffer);
+        header = header->next;
+    }
+    free(buffer);
+    return headerList;
+}
 
-
-        int readyFDs = 0;
-        curl_multi_wait(mc, &readFd, 1, 1, &readyFDs);
-
-        if (readyFDs == 0 && activeHandles == 0 && messagesLeft == 0) {
-            usleep(100 * 1000);
+// Checks the shape of a URL without allocating: an optional scheme, a host, and no
+// whitespace or control characters. libcurl reports anything else when the request is made.
+static int isValidURL(const char* url) {
+    for (const char* c = url; *c != 0; c++) {
+        if ((unsigned char)*c <= ' ' || *c == 0x7f) {
+            return 0;
         }
+    }
 
-        int bytesRead = read(handleReadFD, newHandle.buf, sizeof(newHandle.buf) - newHandlePos);
-        if (bytesRead > 0) {
-            newHandlePos += bytesRead;
+    const char* host = url;
+    const char* separator = strstr(url, "://");
+    if (separator != NULL) {
+        if (separator == url || !isalpha((unsigned char)url[0])) {
+            return 0;
         }
-        if (newHandlePos == sizeof(newHandle.buf)) {
-            curl_multi_add_handle(mc, newHandle.handle);
-            newHandlePos = 0;
+        for (const char* c = url; c < separator; c++) {
+            if (!isalnum((unsigned char)*c) && *c != '+' && *c != '-' && *c != '.') {
+                return 0;
+            }
         }
+        host = separator + 3;
     }
-
-    return NULL;
+    size_t hostLength = strcspn(host, "/?#");
+    return hostLength > 0 && host[0] != ':';
 }
 
-void naettPlatformInit(naettInitData initData) {
-    curl_global_init(CURL_GLOBAL_ALL);
-    CURLM* mc = curl_multi_init();
-    int fds[2];
-    if (pipe(fds) != 0) {
-        panic("Failed to open pipe");
+int naettPlatformInitRequest(InternalRequest* req) {
+    if (!isValidURL(req->url)) {
+        return 0;
     }
-    handleReadFD = fds[0];
-    handleWriteFD = fds[1];
-
-    int flags = fcntl(handleReadFD, F_GETFL, 0);
-    fcntl(handleReadFD, F_SETFL, flags | O_NONBLOCK);
+    req->hostHash = hashHost(req->url);
+    req->headerList = buildHeaderList(req);
+    return req->headerList != NULL;
+}
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create(&workerThread, &attr, curlWorker, mc);
+int naettPlatformSetURL(InternalRequest* req) {
+    if (!isValidURL(req->url)) {
+        return 0;
+    }
+    req->hostHash = hashHost(req->url);
+    return 1;
 }
 
-int naettPlatformInitRequest(InternalRequest* req) {
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    if (!isValidURL(req->url)) {
+        return 0;
+    }
+    req->hostHash = hashHost(req->url);
+    req->headerList = source->headerList;
     return 1;
 }
 
 static size_t readCallback(char* buffer, size_t size, size_t numItems, void* userData) {
     InternalResponse* res = (InternalResponse*)userData;
-    InternalRequest* req = res->request;
-    return req->options.bodyReader(buffer, size * numItems, req->options.bodyReaderData);
+    return (size_t)naettReadBody(res->request, res->bodyReaderData, buffer, size * numItems);
+}
+
+static void noteReceived(InternalResponse* res) {
+    if (res->timed) {
+        res->receivedData = 1;
+        res->lastReceiveMS = monotonicMS();
+    }
 }
 
 static size_t writeCallback(char* ptr, size_t size, size_t numItems, void* userData) {
     InternalResponse* res = (InternalResponse*)userData;
-    InternalRequest* req = res->request;
-    size_t bytesWritten = req->options.bodyWriter(ptr, size * numItems, req->options.bodyWriterData);
+    noteReceived(res);
+    size_t bytesWritten = (size_t)naettWriteBody(res->request, res->bodyWriterData, ptr, size * numItems);
     res->totalBytesRead += bytesWritten;
     return bytesWritten;
 }
@@ -937,46 +2753,48 @@ static void setupMethod(CURL* curl, const char* method) {
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
 }
 
+static void setupHTTPVersion(CURL* curl, int version) {
+    switch (version) {
+        case naettHTTP1_1:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+            break;
+        case naettHTTP2:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            break;
+        case naettHTTP2PriorKnowledge:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            break;
+        default:
+            return;
+    }
+
+    // Wait for a connection that can be multiplexed rather than opening new ones.
+    if (version == naettHTTP2 || pipeWaitPriorKnowledge) {
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+}
+
 static size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userData) {
     InternalResponse* res = (InternalResponse*) userData;
     size_t headerSize = size * nitems;
+    noteReceived(res);
 
-    char* headerName = strndup(buffer, headerSize);
-    char* split = strchr(headerName, ':');
-    if (split) {
-        *split = 0;
-        split++;
-        while (*split == ' ') {
-            split++;
-        }
-        char* headerValue = strdup(split);
-
-        char* cr = strchr(headerValue, 13);
-        if (cr) {
-            *cr = 0;
-        }
-
-        char* lf = strchr(headerValue, 10);
-        if (lf) {
-            *lf = 0;
-        }
-
-        naettAlloc(KVLink, node);
-        node->next = res->headers;
-        node->key = headerName;
-        node->value = headerValue;
-        res->headers = node;
+    if (naettParseHeaderLine(res, buffer, headerSize)) {
+        naettHeadersReceived(res);
     }
 
     return headerSize;
 }
 
-void naettPlatformMakeRequest(InternalResponse* res) {
+static void setupHandle(CURL* c, InternalResponse* res) {
     InternalRequest* req = res->request;
 
-    CURL* c = curl_easy_init();
     curl_easy_setopt(c, CURLOPT_URL, req->url);
     curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, req->options.timeoutMS);
+    if (req->options.lowSpeedSeconds > 0) {
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_LIMIT, (long)req->options.lowSpeedBytesPerSecond);
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_TIME, (long)req->options.lowSpeedSeconds);
+    }
 
     curl_easy_setopt(c, CURLOPT_READFUNCTION, readCallback);
     curl_easy_setopt(c, CURLOPT_READDATA, res);
@@ -989,43 +2807,114 @@ void naettPlatformMakeRequest(InternalResponse* res) {
 
     curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1);
 
-    int bodySize = res->request->options.bodyReader(NULL, 0, res->request->options.bodyReaderData);
-    curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, bodySize);
+    curl_off_t bodySize = (curl_off_t)naettReadBody(req, res->bodyReaderData, NULL, 0);
+    curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE_LARGE, bodySize);
 
     setupMethod(c, req->options.method);
+    setupHTTPVersion(c, req->options.httpVersion);
 
-    struct curl_slist* headerList = NULL;
-    char uaBuf[512];
-    snprintf(uaBuf, sizeof(uaBuf), "User-Agent: %s", req->options.userAgent ? req->options.userAgent : NAETT_UA);
-    headerList = curl_slist_append(headerList, uaBuf);
+    curl_easy_setopt(c, CURLOPT_HTTPHEADER, req->headerList);
+    curl_easy_setopt(c, CURLOPT_PRIVATE, res);
 
-    KVLink* header = req->options.headers;
-    size_t bufferSize = 0;
-    char* buffer = NULL;
-    while (header) {
-        size_t headerLength = strlen(header->key) + strlen(header->value) + 1 + 1;  // colon + null
-        if (headerLength > bufferSize) {
-            bufferSize = headerLength;
-            buffer = (char*)realloc(buffer, bufferSize);
-        }
-        snprintf(buffer, bufferSize, "%s:%s", header->key, header->value);
-        headerList = curl_slist_append(headerList, buffer);
-        header = header->next;
+    const naettConfig* config = &req->options.client->config;
+    curl_easy_setopt(c, CURLOPT_SHARE, req->options.client->share);
+    if (config->dnsCacheTimeout != 0) {
+        curl_easy_setopt(c, CURLOPT_DNS_CACHE_TIMEOUT, (long)config->dnsCacheTimeout);
     }
-    curl_easy_setopt(c, CURLOPT_HTTPHEADER, headerList);
-    free(buffer);
-    res->headerList = headerList;
+    if (config->maxIdleSeconds > 0) {
+        curl_easy_setopt(c, CURLOPT_MAXAGE_CONN, (long)config->maxIdleSeconds);
+    }
+}
 
-    curl_easy_setopt(c, CURLOPT_PRIVATE, res);
+// Returns the worker that processes requests to the host of a request.
+static Worker* requestWorker(InternalRequest* req) {
+    InternalClient* client = req->options.client;
+    return &client->workers[req->hostHash % client->numWorkers];
+}
+
+void naettPlatformMakeRequest(InternalResponse* res) {
+    submit(requestWorker(res->request), res, res);
+}
+
+typedef struct {
+    Worker* worker;
+    InternalResponse* first;
+    InternalResponse* last;
+} SubmitBatch;
+
+// Splits the requests into one chain per worker, so that each worker gets
+// a single submission and at most one wakeup for the whole batch.
+void naettPlatformMakeRequests(InternalResponse* first) {
+    int numRequests = 0;
+    for (InternalResponse* res = first; res != NULL; res = res->nextQueued) {
+        numRequests++;
+    }
+
+    SubmitBatch* batches = (SubmitBatch*)calloc(numRequests, sizeof(SubmitBatch));
+    int numBatches = 0;
+
+    InternalResponse* res = first;
+    while (res != NULL) {
+        InternalResponse* next = res->nextQueued;
+        Worker* worker = requestWorker(res->request);
+
+        SubmitBatch* batch = batches;
+        while (batch < batches + numBatches && batch->worker != worker) {
+            batch++;
+        }
+        if (batch == batches + numBatches) {
+            batch->worker = worker;
+            batch->last = res;
+            numBatches++;
+        }
+        // Chains are pushed as a stack, so link them newest first.
+        res->nextSubmitted = batch->first;
+        batch->first = res;
+
+        res = next;
+    }
 
-    write(handleWriteFD, &c, sizeof(c));
+    for (int i = 0; i < numBatches; i++) {
+        submit(batches[i].worker, batches[i].first, batches[i].last);
+    }
+    free(batches);
 }
 
 void naettPlatformFreeRequest(InternalRequest* req) {
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+    curl_slist_free_all(req->headerList);
+    req->headerList = NULL;
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return client->completionFD;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+    uint64_t value = 1;
+    ssize_t result = pending ? write(client->completionFD, &value, sizeof(value))
+                             : read(client->completionFD, &value, sizeof(value));
+    // EAGAIN means the descriptor is already drained, or already readable
+    if (result != (ssize_t)sizeof(value) && errno != EAGAIN) {
+        panic("Completion descriptor failure");
+    }
+}
+
 void naettPlatformCloseResponse(InternalResponse* res) {
-    curl_slist_free_all(res->headerList);
+}
+
+void naettPlatformCancelResponse(InternalResponse* res) {
+    Worker* worker = requestWorker(res->request);
+
+    InternalResponse* head = __atomic_load_n(&worker->cancellations, __ATOMIC_RELAXED);
+    do {
+        res->nextCancelled = head;
+    } while (
+        !__atomic_compare_exchange_n(&worker->cancellations, &head, res, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    wakeWorker(worker);
 }
 
 #endif
@@ -1100,32 +2989,28 @@ static LPCWSTR packHeaders(InternalRequest* req) {
 
 static void unpackHeaders(InternalResponse* res, LPWSTR packed) {
     size_t len = 0;
-    KVLink* firstHeader = NULL;
     while ((len = wcslen(packed)) != 0) {
         char* header = winToUTF8(packed);
-        char* split = strchr(header, ':');
-        if (split) {
-            *split = 0;
-            split++;
-            while (*split == ' ') {
-                split++;
-            }
-            naettAlloc(KVLink, node);
-            node->key = strdup(header);
-            node->value = strdup(split);
-            node->next = firstHeader;
-            firstHeader = node;
-        }
+        naettParseHeaderLine(res, header, strlen(header));
         free(header);
         packed += len + 1;
     }
-    res->headers = firstHeader;
 }
 
 static void CALLBACK
 callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInformation, DWORD statusInfoLength) {
     InternalResponse* res = (InternalResponse*)context;
 
+    // Cancelling closes the request handle, failing the pending step of the request,
+    // which is then not continued.
+    if (res != NULL && res->cancelState == naettTransferCancelled) {
+        if (!naettAtomicLoad(&res->complete)) {
+            res->code = naettCancelledError;
+            naettCompleteResponse(res);
+        }
+        return;
+    }
+
     switch (status) {
         case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE: {
             DWORD bufSize = 0;
@@ -1145,10 +3030,7 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
             unpackHeaders(res, buffer);
             free(buffer);
 
-            const char* contentLength = naettGetHeader((naettRes*)res, "Content-Length");
-            if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-                res->contentLength = -1;
-            }
+            naettHeadersReceived(res);
 
             DWORD statusCode = 0;
             DWORD statusCodeSize = sizeof(statusCode);
@@ -1163,7 +3045,7 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
 
             if (!WinHttpQueryDataAvailable(request, NULL)) {
                 res->code = naettProtocolError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
         } break;
 
@@ -1171,51 +3053,50 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
             DWORD* available = (DWORD*)statusInformation;
             res->bytesLeft = *available;
             if (res->bytesLeft == 0) {
-                res->complete = 1;
+                naettCompleteResponse(res);
                 break;
             }
 
             size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
             if (!WinHttpReadData(request, res->buffer, (DWORD)bytesToRead, NULL)) {
                 res->code = naettReadError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
         } break;
 
         case WINHTTP_CALLBACK_STATUS_READ_COMPLETE: {
             size_t bytesRead = statusInfoLength;
 
-            InternalRequest* req = res->request;
-            if (req->options.bodyWriter(res->buffer, (int)bytesRead, req->options.bodyWriterData) != bytesRead) {
+            if (naettWriteBody(res->request, res->bodyWriterData, res->buffer, bytesRead) != (long long)bytesRead) {
                 res->code = naettReadError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
-            res->totalBytesRead += (int)bytesRead;
+            res->totalBytesRead += bytesRead;
             res->bytesLeft -= bytesRead;
             if (res->bytesLeft > 0) {
                 size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
                 if (!WinHttpReadData(request, res->buffer, (DWORD)bytesToRead, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             } else {
                 if (!WinHttpQueryDataAvailable(request, NULL)) {
                     res->code = naettProtocolError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             }
         } break;
 
         case WINHTTP_CALLBACK_STATUS_WRITE_COMPLETE:
         case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE: {
-            int bytesRead = res->request->options.bodyReader(
-                res->buffer, sizeof(res->buffer), res->request->options.bodyReaderData);
+            long long bytesRead =
+                naettReadBody(res->request, res->bodyReaderData, res->buffer, sizeof(res->buffer));
             if (bytesRead) {
-                WinHttpWriteData(request, res->buffer, bytesRead, NULL);
+                WinHttpWriteData(request, res->buffer, (DWORD)bytesRead, NULL);
             } else {
                 if (!WinHttpReceiveResponse(request, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             }
         } break;
@@ -1239,12 +3120,14 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
                     res->code = naettGenericError;
             }
 
-            res->complete = 1;
+            naettCompleteResponse(res);
         } break;
     }
 }
 
-int naettPlatformInitRequest(InternalRequest* req) {
+// Connects the session of a request to the host of its URL. On failure,
+// the previous connection is kept.
+static int connectURL(InternalRequest* req) {
     LPWSTR url = winFromUTF8(req->url);
 
     URL_COMPONENTS components;
@@ -1261,10 +3144,31 @@ int naettPlatformInitRequest(InternalRequest* req) {
         return 0;
     }
 
-    req->host = wcsndup(components.lpszHostName, components.dwHostNameLength);
-    req->resource = wcsndup(components.lpszUrlPath, components.dwUrlPathLength + components.dwExtraInfoLength);
+    LPWSTR host = wcsndup(components.lpszHostName, components.dwHostNameLength);
+    LPWSTR resource = wcsndup(components.lpszUrlPath, components.dwUrlPathLength + components.dwExtraInfoLength);
     free(url);
 
+    HINTERNET connection = WinHttpConnect(req->session, host, components.nPort, 0);
+    if (!connection) {
+        free(host);
+        free(resource);
+        return 0;
+    }
+
+    if (req->connection != NULL) {
+        WinHttpCloseHandle(req->connection);
+    }
+    free(req->host);
+    free(req->resource);
+
+    req->connection = connection;
+    req->host = host;
+    req->resource = resource;
+    req->openFlags = components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0;
+    return 1;
+}
+
+int naettPlatformInitRequest(InternalRequest* req) {
     LPWSTR uaBuf = winFromUTF8(req->options.userAgent ? req->options.userAgent : NAETT_UA);
     req->session = WinHttpOpen(uaBuf,
         WINHTTP_ACCESS_TYPE_NO_PROXY,
@@ -1282,65 +3186,74 @@ int naettPlatformInitRequest(InternalRequest* req) {
     // Set the connect timeout. Leave the other three timeouts at their default values.
     WinHttpSetTimeouts(req->session, 0, req->options.timeoutMS, 30000, 30000);
 
-    req->connection = WinHttpConnect(req->session, req->host, components.nPort, 0);
-    if (!req->connection) {
+    if (!connectURL(req)) {
         naettPlatformFreeRequest(req);
         return 0;
     }
 
-    LPWSTR verb = winFromUTF8(req->options.method);
-    req->request = WinHttpOpenRequest(req->connection,
-        verb,
+    // Request handles are opened per response, so that a request can be made
+    // many times concurrently.
+    req->verb = winFromUTF8(req->options.method);
+    req->headers = (LPWSTR)packHeaders(req);
+
+    return 1;
+}
+
+int naettPlatformSetURL(InternalRequest* req) {
+    return connectURL(req);
+}
+
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // The session carries per request callbacks and timeouts, so a clone opens its own.
+    return naettPlatformInitRequest(req);
+}
+
+void naettPlatformMakeRequest(InternalResponse* res) {
+    InternalRequest* req = res->request;
+
+    res->handle = WinHttpOpenRequest(req->connection,
+        req->verb,
         req->resource,
         NULL,
         WINHTTP_NO_REFERER,
         WINHTTP_DEFAULT_ACCEPT_TYPES,
-        components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
-    free(verb);
-    if (!req->request) {
-        naettPlatformFreeRequest(req);
-        return 0;
+        req->openFlags);
+    if (!res->handle) {
+        res->code = naettConnectionError;
+        naettCompleteResponse(res);
+        return;
     }
 
-    LPCWSTR headers = packHeaders(req);
-    if (headers[0] != 0) {
+    if (req->headers[0] != 0) {
         if (!WinHttpAddRequestHeaders(
-                req->request, headers, -1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE)) {
-            naettPlatformFreeRequest(req);
-            free((LPWSTR)headers);
-            return 0;
+                res->handle, req->headers, -1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE)) {
+            res->code = naettGenericError;
+            naettCompleteResponse(res);
+            return;
         }
     }
-    free((LPWSTR)headers);
-
-    return 1;
-}
-
-void naettPlatformMakeRequest(InternalResponse* res) {
-    InternalRequest* req = res->request;
 
     LPCWSTR extraHeaders = WINHTTP_NO_ADDITIONAL_HEADERS;
     WCHAR contentLengthHeader[64];
 
-    int contentLength = req->options.bodyReader(NULL, 0, req->options.bodyReaderData);
+    long long contentLength = naettReadBody(req, res->bodyReaderData, NULL, 0);
     if (contentLength > 0) {
-        swprintf(contentLengthHeader, 64, L"Content-Length: %d", contentLength);
+        swprintf(contentLengthHeader, 64, L"Content-Length: %lld", contentLength);
         extraHeaders = contentLengthHeader;
     }
 
-    if (!WinHttpSendRequest(req->request, extraHeaders, -1, NULL, 0, 0, (DWORD_PTR)res)) {
+    if (!WinHttpSendRequest(res->handle, extraHeaders, -1, NULL, 0, 0, (DWORD_PTR)res)) {
         res->code = naettConnectionError;
-        res->complete = 1;
+        naettCompleteResponse(res);
     }
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
 void naettPlatformFreeRequest(InternalRequest* req) {
     assert(req != NULL);
 
-    if (req->request != NULL) {
-        WinHttpCloseHandle(req->request);
-        req->request = NULL;
-    }
     if (req->connection != NULL) {
         WinHttpCloseHandle(req->connection);
         req->connection = NULL;
@@ -1357,9 +3270,53 @@ void naettPlatformFreeRequest(InternalRequest* req) {
         free(req->resource);
         req->resource = NULL;
     }
+    if (req->verb != NULL) {
+        free(req->verb);
+        req->verb = NULL;
+    }
+    if (req->headers != NULL) {
+        free(req->headers);
+        req->headers = NULL;
+    }
+}
+
+// Closes the request handle of a response, if not already closed.
+static void closeHandle(InternalResponse* res) {
+    HINTERNET handle = (HINTERNET)InterlockedExchangePointer((PVOID volatile*)&res->handle, NULL);
+    if (handle != NULL) {
+        WinHttpCloseHandle(handle);
+    }
 }
 
 void naettPlatformCloseResponse(InternalResponse* res) {
+    closeHandle(res);
+}
+
+void naettPlatformCancelResponse(InternalResponse* res) {
+    // Aborts the pending operation right away. Its error callback then completes the response.
+    closeHandle(res);
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
 }
 
 #endif  // __WINDOWS__
@@ -1451,22 +3408,43 @@ void naettPlatformInit(naettInitData initData) {
     globalVM = initData;
 }
 
-int naettPlatformInitRequest(InternalRequest* req) {
+static jobject createURL(const char* urlString) {
     JNIEnv* env = getEnv();
     (*env)->PushLocalFrame(env, 10);
     jclass URL = (*env)->FindClass(env, "java/net/URL");
     jmethodID newURL = (*env)->GetMethodID(env, URL, "<init>", "(Ljava/lang/String;)V");
-    jstring urlString = (*env)->NewStringUTF(env, req->url);
-    jobject url = (*env)->NewObject(env, URL, newURL, urlString);
+    jstring string = (*env)->NewStringUTF(env, urlString);
+    jobject url = (*env)->NewObject(env, URL, newURL, string);
     if (catch (env)) {
         (*env)->PopLocalFrame(env, NULL);
-        return 0;
+        return NULL;
     }
-    req->urlObject = (*env)->NewGlobalRef(env, url);
+    jobject urlObject = (*env)->NewGlobalRef(env, url);
     (*env)->PopLocalFrame(env, NULL);
+    return urlObject;
+}
+
+int naettPlatformInitRequest(InternalRequest* req) {
+    req->urlObject = createURL(req->url);
+    return req->urlObject != NULL;
+}
+
+int naettPlatformSetURL(InternalRequest* req) {
+    jobject urlObject = createURL(req->url);
+    if (urlObject == NULL) {
+        return 0;
+    }
+    JNIEnv* env = getEnv();
+    (*env)->DeleteGlobalRef(env, req->urlObject);
+    req->urlObject = urlObject;
     return 1;
 }
 
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // Headers are applied per response, so only the URL is per request.
+    return naettPlatformInitRequest(req);
+}
+
 static void* processRequest(void* data) {
     const int bufSize = 10240;
     char byteBuffer[bufSize];
@@ -1521,9 +3499,9 @@ static void* processRequest(void* data) {
 
     if (outputStream != NULL) {
         int bytesRead = 0;
-        if (req->options.bodyReader != NULL)
+        if (req->options.bodyReader != NULL || req->options.bodyReader64 != NULL)
             do {
-                bytesRead = req->options.bodyReader(byteBuffer, bufSize, req->options.bodyReaderData);
+                bytesRead = (int)naettReadBody(req, res->bodyReaderData, byteBuffer, bufSize);
                 if (bytesRead > 0) {
                     (*env)->SetByteArrayRegion(env, buffer, 0, bytesRead, (const jbyte*) byteBuffer);
                     voidCall(env, outputStream, "write", "([BII)V", buffer, 0, bytesRead);
@@ -1544,7 +3522,6 @@ static void* processRequest(void* data) {
     jarray headers = call(env, headerSet, "toArray", "()[Ljava/lang/Object;");
     jsize headerCount = (*env)->GetArrayLength(env, headers);
 
-    KVLink *firstHeader = NULL;
     for (int i = 0; i < headerCount; i++) {
         jstring name = (*env)->GetObjectArrayElement(env, headers, i);
         if (name == NULL) {
@@ -1556,11 +3533,7 @@ static void* processRequest(void* data) {
         jstring value = call(env, values, "get", "(I)Ljava/lang/Object;", 0);
         const char* valueString = (*env)->GetStringUTFChars(env, value, NULL);
 
-        naettAlloc(KVLink, node);
-        node->key = strdup(nameString);
-        node->value = strdup(valueString);
-        node->next = firstHeader;
-        firstHeader = node;
+        naettAddHeader(res, nameString, strlen(nameString), valueString, strlen(valueString));
 
         (*env)->ReleaseStringUTFChars(env, name, nameString);
         (*env)->ReleaseStringUTFChars(env, value, valueString);
@@ -1569,12 +3542,8 @@ static void* processRequest(void* data) {
         (*env)->DeleteLocalRef(env, value);
         (*env)->DeleteLocalRef(env, values);
     }
-    res->headers = firstHeader;
 
-    const char *contentLength = naettGetHeader((naettRes *)res, "Content-Length");
-    if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-        res->contentLength = -1;
-    }
+    naettHeadersReceived(res);
 
     int statusCode = intCall(env, connection, "getResponseCode", "()I");
 
@@ -1601,17 +3570,17 @@ static void* processRequest(void* data) {
             break;
         } else if (bytesRead > 0) {
             (*env)->GetByteArrayRegion(env, buffer, 0, bytesRead, (jbyte*) byteBuffer);
-            req->options.bodyWriter(byteBuffer, bytesRead, req->options.bodyWriterData);
+            naettWriteBody(req, res->bodyWriterData, byteBuffer, bytesRead);
             res->totalBytesRead += bytesRead;
         }
     } while (!res->closeRequested);
 
     voidCall(env, inputStream, "close", "()V");
 
-    res->code = statusCode;
+    res->code = res->closeRequested ? naettCancelledError : statusCode;
 
 finally:
-    res->complete = 1;
+    naettCompleteResponse(res);
     (*env)->PopLocalFrame(env, NULL);
     JavaVM* vm = getVM();
     (*env)->ExceptionClear(env);
@@ -1636,9 +3605,17 @@ void naettPlatformFreeRequest(InternalRequest* req) {
     (*env)->DeleteGlobalRef(env, req->urlObject);
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
 void naettPlatformCloseResponse(InternalResponse* res) {
     res->closeRequested = 1;
     if (res->workerThread != 0) {
+        if (pthread_equal(res->workerThread, pthread_self())) {
+            // Closed from a completion callback on the worker thread itself
+            pthread_detach(res->workerThread);
+            return;
+        }
         int joinResult = pthread_join(res->workerThread, NULL);
         if (joinResult != 0) {
             LOGE("Failed to join: %s", strerror(joinResult));
@@ -1646,6 +3623,33 @@ void naettPlatformCloseResponse(InternalResponse* res) {
     }
 }
 
+void naettPlatformCancelResponse(InternalResponse* res) {
+    // Checked by the worker thread between reads and writes
+    res->closeRequested = 1;
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+}
+
 #endif  // __ANDROID__
 // End of inlined naett_android.c //
 
@@ -20,12 +20,103 @@ typedef void* naettInitData;
  */
 void naettInit(naettInitData initThing);
 
+typedef struct naettConfig {
+    // Number of threads processing requests. Requests to the same host
+    // are always processed by the same thread. Defaults to 1, and is capped
+    // at `maxConnections`. Linux only.
+    int workerThreads;
+    // Default connection timeout in milliseconds. Defaults to 5000.
+    int timeoutMS;
+    // Default request timeouts, see `naettDeadline`, `naettFirstByteTimeout`,
+    // `naettIdleTimeout` and `naettLowSpeed`. Default to none. Linux only.
+    int deadlineMS;
+    int firstByteTimeoutMS;
+    int idleTimeoutMS;
+    int lowSpeedBytesPerSecond;
+    int lowSpeedSeconds;
+    // Default user agent. Defaults to `NAETT_UA`.
+    const char* userAgent;
+    // Seconds to keep resolved host names in the DNS cache shared by all
+    // workers, or -1 to keep them forever. Defaults to 60. Linux only.
+    int dnsCacheTimeout;
+    // Maximum number of idle connections kept open for reuse per worker.
+    // Defaults to libcurl's default. Linux only.
+    int connectionCacheSize;
+    // Default HTTP version, one of the `naettHTTPVersion` values.
+    int httpVersion;
+    // Maximum number of concurrent HTTP/2 streams per connection.
+    // Defaults to libcurl's default. Linux only.
+    int maxConcurrentStreams;
+    // Maximum number of connections open to a single host. Requests over the
+    // limit wait for a free connection. Defaults to unlimited. Linux only.
+    int maxHostConnections;
+    // Maximum number of connections open in total, divided evenly between the
+    // workers. Requests over the limit wait for a free connection.
+    // As all requests to a host go to the same worker, a client talking to a
+    // single host can only use its worker's share, `maxConnections / workerThreads`.
+    // Defaults to unlimited. Linux only.
+    int maxConnections;
+    // Idle connections older than this many seconds are not reused.
+    // Defaults to libcurl's default. Linux only.
+    int maxIdleSeconds;
+    // Maximum number of requests in flight. Requests made over the limit
+    // wait in FIFO order until an earlier request completes.
+    // Defaults to unlimited.
+    int maxActive;
+    // Maximum number of requests waiting when `maxActive` is reached.
+    // Requests made when the queue is full complete immediately with
+    // `naettWouldBlockError`. Only used with `maxActive`.
+    int maxQueued;
+    // Largest number of bytes reserved up front for a response body from its
+    // Content-Length, so that a bogus length cannot force a huge allocation.
+    // Bodies above it grow as they arrive. Defaults to 1 MiB, -1 disables.
+    int maxBodyPreallocation;
+} naettConfig;
+
+enum naettHTTPVersion {
+    // Let the platform choose.
+    naettHTTPDefault = 0,
+    naettHTTP1_1 = 1,
+    // HTTP/2 for https URLs, HTTP/1.1 for http URLs.
+    naettHTTP2 = 2,
+    // HTTP/2 without upgrade, also for cleartext http URLs.
+    naettHTTP2PriorKnowledge = 3,
+};
+
+/**
+ * @brief Global init method with configuration.
+ * Call instead of `naettInit` to configure the library and its default client.
+ * Zero-valued fields use their defaults.
+ */
+void naettInitWithConfig(naettInitData initThing, const naettConfig* config);
+
+typedef struct naettClient naettClient;
+
+/**
+ * @brief Creates a client with its own worker threads, connection pool,
+ * limits and request defaults, isolated from all other clients.
+ * Requests are bound to a client using the `naettUseClient` option, and
+ * use the default client otherwise.
+ * Zero-valued config fields use their defaults.
+ */
+naettClient* naettClientCreate(const naettConfig* config);
+
+/**
+ * @brief Frees a client.
+ * The client must not have any pending responses.
+ */
+void naettClientFree(naettClient* client);
+
 typedef struct naettReq naettReq;
 typedef struct naettRes naettRes;
 // If naettReadFunc is called with NULL dest, it must respond with the body size
 typedef int (*naettReadFunc)(void* dest, int bufferSize, void* userData);
 typedef int (*naettWriteFunc)(const void* source, int bytes, void* userData);
+// 64-bit variants of the body reader and writer, for bodies over 2 GiB.
+typedef long long (*naettReadFunc64)(void* dest, long long bufferSize, void* userData);
+typedef long long (*naettWriteFunc64)(const void* source, long long bytes, void* userData);
 typedef int (*naettHeaderLister)(const char* name, const char* value, void* userData);
+typedef void (*naettCompleteFunc)(naettRes* response, int status, void* userData);
 
 // Option to `naettRequest`
 typedef struct naettOption naettOption;
@@ -38,14 +129,44 @@ naettOption* naettHeader(const char* name, const char* value);
 // The body is not copied, and the passed pointer must be valid for the
 // lifetime of the request.
 naettOption* naettBody(const char* body, int size);
+// Sets a request body of up to 2^63 - 1 bytes, see `naettBody`.
+naettOption* naettBody64(const char* body, long long size);
 // Sets a request body reader.
 naettOption* naettBodyReader(naettReadFunc reader, void* userData);
+// Sets a 64-bit request body reader. Takes precedence over `naettBodyReader`.
+naettOption* naettBodyReader64(naettReadFunc64 reader, void* userData);
 // Sets a response body writer.
 naettOption* naettBodyWriter(naettWriteFunc writer, void* userData);
+// Sets a 64-bit response body writer. Takes precedence over `naettBodyWriter`.
+naettOption* naettBodyWriter64(naettWriteFunc64 writer, void* userData);
+// Sets a completion callback, called once from a library thread when the response is done.
+// The callback runs before `naettComplete` reports the response as complete,
+// and may close the response. It is not called for responses rejected with
+// `naettWouldBlockError`, which are already complete when `naettMake` returns.
+naettOption* naettOnComplete(naettCompleteFunc callback, void* userData);
 // Sets connection timeout in milliseconds.
+// Fails with `naettConnectTimeoutError` on Linux only, other platforms report a connection error.
 naettOption* naettTimeout(int milliSeconds);
+// Sets the maximum time in milliseconds for the whole request, including the
+// connection and the body. Fails with `naettDeadlineError`. Linux only.
+naettOption* naettDeadline(int milliSeconds);
+// Sets the maximum time in milliseconds from the start of the request until the
+// first response byte arrives. Fails with `naettFirstByteTimeoutError`. Linux only.
+naettOption* naettFirstByteTimeout(int milliSeconds);
+// Sets the maximum time in milliseconds between two received chunks of the response,
+// once it has started arriving. Fails with `naettIdleTimeoutError`. Linux only.
+naettOption* naettIdleTimeout(int milliSeconds);
+// Aborts the request when the transfer speed stays below `bytesPerSecond` for
+// `seconds` seconds. Fails with `naettLowSpeedError`. Linux only.
+naettOption* naettLowSpeed(int bytesPerSecond, int seconds);
 // Sets the user agent.
 naettOption* naettUserAgent(const char *userAgent);
+// Sets the HTTP version, one of the `naettHTTPVersion` values.
+// HTTP/2 requests to the same host are multiplexed over shared connections. Linux only.
+naettOption* naettHTTPVersion(int version);
+// Binds the request to a client created by `naettClientCreate`.
+// The client must outlive the request.
+naettOption* naettUseClient(naettClient* client);
 
 /**
  * @brief Creates a new request to the specified url.
@@ -59,16 +180,85 @@ naettOption* naettUserAgent(const char *userAgent);
  */
 naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOption** options);
 
+typedef struct naettHeaderPair {
+    const char* name;
+    const char* value;
+} naettHeaderPair;
+
+// Request configuration for `naettRequestWithConfig`, with fields matching
+// the request options. Zero-valued fields use their defaults.
+typedef struct naettRequestConfig {
+    const char* method;
+    const naettHeaderPair* headers;
+    int numHeaders;
+    const char* body;
+    long long bodySize;
+    naettReadFunc bodyReader;
+    naettReadFunc64 bodyReader64;
+    void* bodyReaderData;
+    naettWriteFunc bodyWriter;
+    naettWriteFunc64 bodyWriter64;
+    void* bodyWriterData;
+    naettCompleteFunc onComplete;
+    void* onCompleteData;
+    const char* userAgent;
+    int timeoutMS;
+    int deadlineMS;
+    int firstByteTimeoutMS;
+    int idleTimeoutMS;
+    int lowSpeedBytesPerSecond;
+    int lowSpeedSeconds;
+    int httpVersion;
+    naettClient* client;
+} naettRequestConfig;
+
+/**
+ * @brief Creates a new request to the specified url.
+ * Uses a configuration struct rather than options, which avoids allocating
+ * and freeing an option object per setting.
+ * The config and the strings it points to are copied, except for the body.
+ */
+naettReq* naettRequestWithConfig(const char* url, const naettRequestConfig* config);
+
+/**
+ * @brief Creates a copy of a request with a different URL.
+ * The copy has the same method, headers, body and other options as the
+ * original, without applying them again. Their storage is shared rather than
+ * copied, and the original and the copy can be freed in any order.
+ * Returns NULL if the URL is not valid.
+ */
+naettReq* naettReqClone(naettReq* request, const char* url);
+
+/**
+ * @brief Changes the URL of a request, keeping all of its options.
+ * Must not be called while responses to the request are pending.
+ * Returns 0 and keeps the previous URL if the new one is not valid.
+ */
+int naettSetURL(naettReq* request, const char* url);
+
 /**
  * @brief Makes a request and returns a response object.
  * The actual request is processed asynchronously, use `naettComplete`
- * to check if the response is completed.
+ * to check if the response is completed, or `naettWait` to wait for it.
  *
- * A request object can be reused multiple times to make requests, but
- * there can be only one active request using the same request object.
+ * A request object can be reused multiple times to make requests, also
+ * concurrently. Custom body readers and writers are then shared between
+ * the concurrent requests, and must handle that themselves.
+ *
+ * When the client's `maxActive` and `maxQueued` limits are reached, the
+ * returned response is already complete with status `naettWouldBlockError`,
+ * and its completion callback is not called.
  */
 naettRes* naettMake(naettReq* request);
 
+/**
+ * @brief Makes `numRequests` requests at once, storing their response objects
+ * in `responses`. Works like calling `naettMake` for each request, but hands
+ * the whole batch to the worker threads at once, which is cheaper when
+ * submitting many requests.
+ */
+void naettMakeBatch(naettReq** requests, int numRequests, naettRes** responses);
+
 /**
  * @brief Frees a previously allocated request object.
  * The request must not have any pending responses.
@@ -82,12 +272,68 @@ void naettFree(naettReq* request);
  */
 int naettComplete(const naettRes* response);
 
+/**
+ * @brief Waits until a response is complete, or until `timeoutMS` milliseconds
+ * have passed. A negative timeout waits forever.
+ * Returns 1 if the response is complete, 0 on timeout.
+ */
+int naettWait(naettRes* response, int timeoutMS);
+
+/**
+ * @brief Waits until any of the passed responses is complete, or until `timeoutMS`
+ * milliseconds have passed. A negative timeout waits forever.
+ * Returns 1 and stores the position of a completed response in `index`,
+ * or returns 0 on timeout.
+ * Waiting on responses of a single client is only woken by completions of that
+ * client. Responses of several clients can be waited for together, but then every
+ * completion in the process signals the wait, and each completion pays for
+ * signalling while such a wait is in progress.
+ */
+int naettWaitAny(naettRes** responses, int numResponses, int timeoutMS, int* index);
+
+/**
+ * @brief Returns a file descriptor that becomes readable while the client has
+ * completed responses to collect using `naettClientGetCompleted`.
+ * The descriptor can be added to an epoll / poll loop, but must not be
+ * read from or closed by the caller.
+ * Only supported on Linux, returns -1 on other platforms.
+ */
+int naettClientCompletionFD(naettClient* client);
+
+/**
+ * @brief Collects up to `maxResponses` completed responses of a client, in completion order.
+ * Each completed response is collected at most once. Closed responses and responses
+ * with a completion callback, see `naettOnComplete`, are never collected.
+ * Returns the number of responses stored in `responses`.
+ */
+int naettClientGetCompleted(naettClient* client, naettRes** responses, int maxResponses);
+
+/**
+ * @brief `naettClientCompletionFD` for the default client.
+ */
+int naettCompletionFD(void);
+
+/**
+ * @brief `naettClientGetCompleted` for the default client.
+ */
+int naettGetCompleted(naettRes** responses, int maxResponses);
+
 enum naettStatus {
     naettConnectionError = -1,
     naettProtocolError = -2,
     naettReadError = -3,
     naettWriteError = -4,
     naettGenericError = -5,
+    // The client had too many requests in flight and queued, see `naettConfig`.
+    naettWouldBlockError = -6,
+    // The request was cancelled by `naettCancel` or `naettClose`.
+    naettCancelledError = -7,
+    // Timeouts, see the corresponding request options.
+    naettConnectTimeoutError = -8,
+    naettDeadlineError = -9,
+    naettFirstByteTimeoutError = -10,
+    naettIdleTimeoutError = -11,
+    naettLowSpeedError = -12,
     naettProcessing = 0,
 };
 
@@ -103,21 +349,39 @@ int naettGetStatus(const naettRes* response);
  * @brief Returns the response body.
  * The body returned by this method is always empty when a custom
  * body reader has been set up using the `naettBodyReader` option.
+ * Sizes over 2 GiB are reported as INT_MAX, use `naettGetBody64` for those.
  */
 const void* naettGetBody(naettRes* response, int* outSize);
 
+/**
+ * @brief Returns the response body and its 64-bit size, see `naettGetBody`.
+ */
+const void* naettGetBody64(naettRes* response, long long* outSize);
+
 /**
  * @brief Returns the HTTP header value for the specified header name.
  */
 const char* naettGetHeader(naettRes* response, const char* name);
 
+/**
+ * @brief Returns the HTTP header value for the header name of `nameLength` bytes
+ * at `name`, which does not need to be zero terminated.
+ */
+const char* naettGetHeaderN(naettRes* response, const char* name, int nameLength);
+
 /**
  * @brief Returns how many bytes have been read from the response so far,
  * and the integer pointed to by totalSize gets the Content-Length if available,
  * or -1 if not (or 0 if headers have not been read yet).
+ * Counts over 2 GiB are reported as INT_MAX, use `naettGetTotalBytesRead64` for those.
  */
 int naettGetTotalBytesRead(naettRes* response, int* totalSize);
 
+/**
+ * @brief 64-bit variant of `naettGetTotalBytesRead`.
+ */
+long long naettGetTotalBytesRead64(naettRes* response, long long* totalSize);
+
 /**
  * @brief Enumerates all response headers as long as the `lister`
  * returns true.
@@ -129,8 +393,21 @@ void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userDa
  */
 naettReq* naettGetRequest(naettRes* response);
 
+/**
+ * @brief Cancels a pending request. The response completes with status
+ * `naettCancelledError`, unless it completes normally before the cancellation
+ * takes effect. Cancelling a completed response does nothing.
+ */
+void naettCancel(naettRes* response);
+
 /**
  * @brief Closes a response object.
+ * A pending response is cancelled first, and the call blocks until the
+ * cancellation has taken effect. Pending responses must therefore not be
+ * closed from completion callbacks of other responses.
+ * The completion callback of a response closed before it completes is not called.
+ * A response may be closed from any thread while its callback runs, and is then
+ * freed when the callback returns.
  */
 void naettClose(naettRes* response);
 
@@ -83,22 +83,43 @@ void naettPlatformInit(naettInitData initData) {
     globalVM = initData;
 }
 
-int naettPlatformInitRequest(InternalRequest* req) {
+static jobject createURL(const char* urlString) {
     JNIEnv* env = getEnv();
     (*env)->PushLocalFrame(env, 10);
     jclass URL = (*env)->FindClass(env, "java/net/URL");
     jmethodID newURL = (*env)->GetMethodID(env, URL, "<init>", "(Ljava/lang/String;)V");
-    jstring urlString = (*env)->NewStringUTF(env, req->url);
-    jobject url = (*env)->NewObject(env, URL, newURL, urlString);
+    jstring string = (*env)->NewStringUTF(env, urlString);
+    jobject url = (*env)->NewObject(env, URL, newURL, string);
     if (catch (env)) {
         (*env)->PopLocalFrame(env, NULL);
-        return 0;
+        return NULL;
     }
-    req->urlObject = (*env)->NewGlobalRef(env, url);
+    jobject urlObject = (*env)->NewGlobalRef(env, url);
     (*env)->PopLocalFrame(env, NULL);
+    return urlObject;
+}
+
+int naettPlatformInitRequest(InternalRequest* req) {
+    req->urlObject = createURL(req->url);
+    return req->urlObject != NULL;
+}
+
+int naettPlatformSetURL(InternalRequest* req) {
+    jobject urlObject = createURL(req->url);
+    if (urlObject == NULL) {
+        return 0;
+    }
+    JNIEnv* env = getEnv();
+    (*env)->DeleteGlobalRef(env, req->urlObject);
+    req->urlObject = urlObject;
     return 1;
 }
 
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // Headers are applied per response, so only the URL is per request.
+    return naettPlatformInitRequest(req);
+}
+
 static void* processRequest(void* data) {
     const int bufSize = 10240;
     char byteBuffer[bufSize];
@@ -153,9 +174,9 @@ static void* processRequest(void* data) {
 
     if (outputStream != NULL) {
         int bytesRead = 0;
-        if (req->options.bodyReader != NULL)
+        if (req->options.bodyReader != NULL || req->options.bodyReader64 != NULL)
             do {
-                bytesRead = req->options.bodyReader(byteBuffer, bufSize, req->options.bodyReaderData);
+                bytesRead = (int)naettReadBody(req, res->bodyReaderData, byteBuffer, bufSize);
                 if (bytesRead > 0) {
                     (*env)->SetByteArrayRegion(env, buffer, 0, bytesRead, (const jbyte*) byteBuffer);
                     voidCall(env, outputStream, "write", "([BII)V", buffer, 0, bytesRead);
@@ -176,7 +197,6 @@ static void* processRequest(void* data) {
     jarray headers = call(env, headerSet, "toArray", "()[Ljava/lang/Object;");
     jsize headerCount = (*env)->GetArrayLength(env, headers);
 
-    KVLink *firstHeader = NULL;
     for (int i = 0; i < headerCount; i++) {
         jstring name = (*env)->GetObjectArrayElement(env, headers, i);
         if (name == NULL) {
@@ -188,11 +208,7 @@ static void* processRequest(void* data) {
         jstring value = call(env, values, "get", "(I)Ljava/lang/Object;", 0);
         const char* valueString = (*env)->GetStringUTFChars(env, value, NULL);
 
-        naettAlloc(KVLink, node);
-        node->key = strdup(nameString);
-        node->value = strdup(valueString);
-        node->next = firstHeader;
-        firstHeader = node;
+        naettAddHeader(res, nameString, strlen(nameString), valueString, strlen(valueString));
 
         (*env)->ReleaseStringUTFChars(env, name, nameString);
         (*env)->ReleaseStringUTFChars(env, value, valueString);
@@ -201,12 +217,8 @@ static void* processRequest(void* data) {
         (*env)->DeleteLocalRef(env, value);
         (*env)->DeleteLocalRef(env, values);
     }
-    res->headers = firstHeader;
 
-    const char *contentLength = naettGetHeader((naettRes *)res, "Content-Length");
-    if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-        res->contentLength = -1;
-    }
+    naettHeadersReceived(res);
 
     int statusCode = intCall(env, connection, "getResponseCode", "()I");
 
@@ -233,17 +245,17 @@ static void* processRequest(void* data) {
             break;
         } else if (bytesRead > 0) {
             (*env)->GetByteArrayRegion(env, buffer, 0, bytesRead, (jbyte*) byteBuffer);
-            req->options.bodyWriter(byteBuffer, bytesRead, req->options.bodyWriterData);
+            naettWriteBody(req, res->bodyWriterData, byteBuffer, bytesRead);
             res->totalBytesRead += bytesRead;
         }
     } while (!res->closeRequested);
 
     voidCall(env, inputStream, "close", "()V");
 
-    res->code = statusCode;
+    res->code = res->closeRequested ? naettCancelledError : statusCode;
 
 finally:
-    res->complete = 1;
+    naettCompleteResponse(res);
     (*env)->PopLocalFrame(env, NULL);
     JavaVM* vm = getVM();
     (*env)->ExceptionClear(env);
@@ -268,9 +280,17 @@ void naettPlatformFreeRequest(InternalRequest* req) {
     (*env)->DeleteGlobalRef(env, req->urlObject);
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
 void naettPlatformCloseResponse(InternalResponse* res) {
     res->closeRequested = 1;
     if (res->workerThread != 0) {
+        if (pthread_equal(res->workerThread, pthread_self())) {
+            // Closed from a completion callback on the worker thread itself
+            pthread_detach(res->workerThread);
+            return;
+        }
         int joinResult = pthread_join(res->workerThread, NULL);
         if (joinResult != 0) {
             LOGE("Failed to join: %s", strerror(joinResult));
@@ -278,4 +298,31 @@ void naettPlatformCloseResponse(InternalResponse* res) {
     }
 }
 
+void naettPlatformCancelResponse(InternalResponse* res) {
+    // Checked by the worker thread between reads and writes
+    res->closeRequested = 1;
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+}
+
 #endif  // __ANDROID__
@@ -4,6 +4,20 @@
 #include <stddef.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#if !__WINDOWS__
+#include <time.h>
+#endif
+
+// Define NAETT_NO_SIMD to use the scalar header parser.
+#if !defined(NAETT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define naettSSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
 
 typedef struct InternalParam* InternalParamPtr;
 typedef void (*ParamSetter)(InternalParamPtr param, InternalRequest* req);
@@ -13,6 +27,7 @@ typedef struct InternalParam {
         int offset;
         union {
             int integer;
+            long long integer64;
             const char* string;
             struct {
                 const char* key;
@@ -45,45 +60,54 @@ static void intSetter(InternalParamPtr param, InternalRequest* req) {
     *intField = param->integer;
 }
 
+static void int64Setter(InternalParamPtr param, InternalRequest* req) {
+    char* opaque = (char*)&req->options;
+    long long* intField = (long long*)(opaque + param->offset);
+    *intField = param->integer64;
+}
+
 static void ptrSetter(InternalParamPtr param, InternalRequest* req) {
     char* opaque = (char*)&req->options;
     void** ptrField = (void**)(opaque + param->offset);
     *ptrField = param->ptr;
 }
 
+static void addKV(KVLink** list, const char* key, const char* value) {
+    naettAlloc(KVLink, newNode);
+    newNode->key = strdup(key);
+    newNode->value = strdup(value);
+    newNode->next = *list;
+
+    *list = newNode;
+}
+
 static void kvSetter(InternalParamPtr param, InternalRequest* req) {
     char* opaque = (char*)&req->options;
     KVLink** kvField = (KVLink**)(opaque + param->offset);
-
-    naettAlloc(KVLink, newNode);
-    newNode->key = strdup(param->kv.key);
-    newNode->value = strdup(param->kv.value);
-    newNode->next = *kvField;
-
-    *kvField = newNode;
+    addKV(kvField, param->kv.key, param->kv.value);
 }
 
-static int defaultBodyReader(void* dest, int bufferSize, void* userData) {
+static long long defaultBodyReader(void* dest, long long bufferSize, void* userData) {
     Buffer* buffer = (Buffer*) userData;
 
     if (dest == NULL) {
         return buffer->size;
     }
 
-    int bytesToRead = buffer->size - buffer->position;
+    long long bytesToRead = buffer->size - buffer->position;
     if (bytesToRead > bufferSize) {
         bytesToRead = bufferSize;
     }
 
     const char* source = ((const char*)buffer->data) + buffer->position;
-    memcpy(dest, source, bytesToRead);
+    memcpy(dest, source, (size_t)bytesToRead);
     buffer->position += bytesToRead;
     return bytesToRead;
 }
 
-static int defaultBodyWriter(const void* source, int bytes, void* userData) {
+static long long defaultBodyWriter(const void* source, long long bytes, void* userData) {
     Buffer* buffer = (Buffer*) userData;
-    int newCapacity = buffer->capacity;
+    long long newCapacity = buffer->capacity;
     if (newCapacity == 0) {
         newCapacity = bytes;
     }
@@ -91,22 +115,104 @@ static int defaultBodyWriter(const void* source, int bytes, void* userData) {
         newCapacity *= 2;
     }
     if (newCapacity != buffer->capacity) {
-        buffer->data = realloc(buffer->data, newCapacity);
+        if ((unsigned long long)newCapacity > SIZE_MAX) {
+            return 0;
+        }
+        void* data = realloc(buffer->data, (size_t)newCapacity);
+        if (data == NULL) {
+            return 0;
+        }
+        buffer->data = data;
         buffer->capacity = newCapacity;
     }
     char* dest = ((char*)buffer->data) + buffer->size;
-    memcpy(dest, source, bytes);
+    memcpy(dest, source, (size_t)bytes);
     buffer->size += bytes;
     return bytes;
 }
 
+static void reserveBody(Buffer* buffer, long long capacity) {
+    if (capacity <= buffer->capacity || (unsigned long long)capacity > SIZE_MAX) {
+        return;
+    }
+    void* data = realloc(buffer->data, (size_t)capacity);
+    if (data != NULL) {
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
 static int initialized = 0;
+static InternalClient* defaultClient = NULL;
+
+// Signalled on every completion while `naettWaitAny` waits on responses of several clients.
+static naettMutex crossClientLock;
+static naettCond crossClientSignal;
+static int numCrossClientWaiters = 0;
 
 static void initRequest(InternalRequest* req, const char* url) {
     assert(initialized);
     req->options.method = strdup("GET");
-    req->options.timeoutMS = 5000;
+    req->options.timeoutMS = -1;
     req->url = strdup(url);
+    req->refCount = (int*)malloc(sizeof(int));
+    *req->refCount = 1;
+}
+
+static void applyClientDefaults(InternalRequest* req) {
+    if (req->options.client == NULL) {
+        req->options.client = defaultClient;
+    }
+    const naettConfig* config = &req->options.client->config;
+    if (req->options.timeoutMS < 0) {
+        req->options.timeoutMS = config->timeoutMS;
+    }
+    if (req->options.deadlineMS == 0) {
+        req->options.deadlineMS = config->deadlineMS;
+    }
+    if (req->options.firstByteTimeoutMS == 0) {
+        req->options.firstByteTimeoutMS = config->firstByteTimeoutMS;
+    }
+    if (req->options.idleTimeoutMS == 0) {
+        req->options.idleTimeoutMS = config->idleTimeoutMS;
+    }
+    if (req->options.lowSpeedSeconds == 0) {
+        req->options.lowSpeedBytesPerSecond = config->lowSpeedBytesPerSecond;
+        req->options.lowSpeedSeconds = config->lowSpeedSeconds;
+    }
+    if (req->options.httpVersion == naettHTTPDefault) {
+        req->options.httpVersion = config->httpVersion;
+    }
+    if (req->options.userAgent == NULL && config->userAgent != NULL) {
+        req->options.userAgent = strdup(config->userAgent);
+    }
+}
+
+static InternalClient* createClient(const naettConfig* config) {
+    naettAlloc(InternalClient, client);
+    client->config = *config;
+    naettMutexInit(&client->admissionLock);
+    naettMutexInit(&client->completionLock);
+    naettCondInit(&client->completionSignal);
+    if (client->config.timeoutMS <= 0) {
+        client->config.timeoutMS = 5000;
+    }
+    if (client->config.maxBodyPreallocation == 0) {
+        client->config.maxBodyPreallocation = 1024 * 1024;
+    }
+    if (config->userAgent != NULL) {
+        client->config.userAgent = strdup(config->userAgent);
+    }
+
+    if (!naettPlatformInitClient(client)) {
+        naettMutexDestroy(&client->admissionLock);
+        naettMutexDestroy(&client->completionLock);
+        naettCondDestroy(&client->completionSignal);
+        free((void*)client->config.userAgent);
+        free(client);
+        return NULL;
+    }
+    return client;
 }
 
 static void applyOptionParams(InternalRequest* req, InternalOption* option) {
@@ -116,14 +222,316 @@ static void applyOptionParams(InternalRequest* req, InternalOption* option) {
     }
 }
 
+static void completeResponses(InternalResponse* first, int notify);
+
+// Takes an admission slot for a response, or queues it when all slots are taken.
+// Returns 1 if the request should be made right away. When the queue is full too,
+// the response is completed with `naettWouldBlockError`, without calling its
+// completion callback, as the caller has not even got the response yet.
+static int admitResponse(InternalClient* client, InternalResponse* res) {
+    if (client->config.maxActive <= 0) {
+        return 1;
+    }
+
+    // Once admitted, the response may complete and release its slot at any time.
+    int admitted = 0;
+    int admitNow = 0;
+    naettMutexLock(&client->admissionLock);
+    if (client->numActive < client->config.maxActive) {
+        client->numActive++;
+        res->admitted = 1;
+        admitted = 1;
+        admitNow = 1;
+    } else if (client->numQueued < client->config.maxQueued) {
+        res->nextQueued = NULL;
+        res->prevQueued = client->lastQueued;
+        if (client->lastQueued) {
+            client->lastQueued->nextQueued = res;
+        } else {
+            client->firstQueued = res;
+        }
+        client->lastQueued = res;
+        client->numQueued++;
+        naettAtomicStore(&res->queued, 1);
+        res->admitted = 1;
+        admitted = 1;
+    }
+    naettMutexUnlock(&client->admissionLock);
+
+    if (!admitted) {
+        res->code = naettWouldBlockError;
+        res->nextCompleted = NULL;
+        completeResponses(res, 0);
+    }
+    return admitNow;
+}
+
+// Removes a response from the admission queue of its client. Must be called with
+// `admissionLock` held.
+static void unlinkQueued(InternalClient* client, InternalResponse* res) {
+    if (res->prevQueued) {
+        res->prevQueued->nextQueued = res->nextQueued;
+    } else {
+        client->firstQueued = res->nextQueued;
+    }
+    if (res->nextQueued) {
+        res->nextQueued->prevQueued = res->prevQueued;
+    } else {
+        client->lastQueued = res->prevQueued;
+    }
+    res->nextQueued = NULL;
+    res->prevQueued = NULL;
+    client->numQueued--;
+    naettAtomicStore(&res->queued, 0);
+}
+
+// Hands the admission slot of a completed response over to the oldest queued response.
+static void releaseAdmission(InternalResponse* res) {
+    if (!res->admitted) {
+        return;
+    }
+    res->admitted = 0;
+
+    InternalClient* client = res->request->options.client;
+    naettMutexLock(&client->admissionLock);
+    InternalResponse* next = client->firstQueued;
+    if (next) {
+        unlinkQueued(client, next);
+    } else {
+        client->numActive--;
+    }
+    naettMutexUnlock(&client->admissionLock);
+
+    if (next) {
+        naettPlatformMakeRequest(next);
+    }
+}
+
+// Takes a response out of the admission queue of its client, giving up its place.
+// Returns 0 if it was not queued.
+static int unqueueAdmission(InternalResponse* res) {
+    // A response is only ever queued by `naettMake`, before the caller gets it,
+    // so one found unqueued here stays that way.
+    if (!naettAtomicLoad(&res->queued)) {
+        return 0;
+    }
+
+    InternalClient* client = res->request->options.client;
+    int found = 0;
+
+    naettMutexLock(&client->admissionLock);
+    if (res->queued) {
+        unlinkQueued(client, res);
+        res->admitted = 0;
+        found = 1;
+    }
+    naettMutexUnlock(&client->admissionLock);
+    return found;
+}
+
+static int isQueuedCompletion(InternalClient* client, InternalResponse* res) {
+    return res->prevCompleted != NULL || client->firstCompleted == res;
+}
+
+static void dequeueCompletion(InternalClient* client, InternalResponse* res) {
+    if (res->prevCompleted) {
+        res->prevCompleted->nextCompleted = res->nextCompleted;
+    } else {
+        client->firstCompleted = res->nextCompleted;
+    }
+    if (res->nextCompleted) {
+        res->nextCompleted->prevCompleted = res->prevCompleted;
+    } else {
+        client->lastCompleted = res->prevCompleted;
+    }
+    res->nextCompleted = NULL;
+    res->prevCompleted = NULL;
+}
+
+static void enqueueCompletion(InternalClient* client, InternalResponse* res) {
+    if (client->firstCompleted == NULL) {
+        naettPlatformSignalCompletion(client, 1);
+    }
+    res->nextCompleted = NULL;
+    res->prevCompleted = client->lastCompleted;
+    if (client->lastCompleted) {
+        client->lastCompleted->nextCompleted = res;
+    } else {
+        client->firstCompleted = res;
+    }
+    client->lastCompleted = res;
+}
+
+static void freeResponse(InternalResponse* res);
+
+// Runs the completion callback of a response, if there is one.
+// Returns 0 if the response was closed by the callback.
+static int notifyCompletion(InternalResponse* res) {
+    RequestOptions* options = &res->request->options;
+    if (options->onComplete == NULL) {
+        return 1;
+    }
+
+    if (!naettAtomicCAS(&res->closeState, 0, naettInCallback)) {
+        // Being closed, and waited for by `naettClose`
+        return 1;
+    }
+    options->onComplete((naettRes*)res, res->code, options->onCompleteData);
+
+    if (!naettAtomicCAS(&res->closeState, naettInCallback, 0)) {
+        // Closed by the callback, or by another thread while it ran
+        freeResponse(res);
+        return 0;
+    }
+    return 1;
+}
+
+static void completeResponses(InternalResponse* first, int notify) {
+    InternalResponse* remaining = NULL;
+    InternalResponse** link = &remaining;
+
+    InternalResponse* res = first;
+    while (res != NULL) {
+        InternalResponse* next = res->nextCompleted;
+        // Too late to cancel from here on
+        naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing);
+        releaseAdmission(res);
+        if (!notify || notifyCompletion(res)) {
+            *link = res;
+            link = &res->nextCompleted;
+        }
+        res = next;
+    }
+    *link = NULL;
+
+    if (remaining == NULL) {
+        return;
+    }
+
+    // Batches normally hold responses of a single client, which is locked once.
+    InternalClient* locked = NULL;
+    res = remaining;
+    while (res != NULL) {
+        InternalResponse* next = res->nextCompleted;
+        InternalClient* client = res->request->options.client;
+        if (client != locked) {
+            if (locked != NULL) {
+                naettCondBroadcast(&locked->completionSignal);
+                naettMutexUnlock(&locked->completionLock);
+            }
+            naettMutexLock(&client->completionLock);
+            locked = client;
+        }
+        naettAtomicStore(&res->complete, 1);
+        res->nextCompleted = NULL;
+        // Responses with callbacks are only waited for, never collected.
+        if (res->request->options.onComplete == NULL) {
+            enqueueCompletion(client, res);
+        }
+        res = next;
+    }
+    naettCondBroadcast(&locked->completionSignal);
+    naettMutexUnlock(&locked->completionLock);
+
+    // Pairs with the increment in `naettWaitAny`, so either the waiter sees the
+    // responses complete, or the completion sees the waiter.
+    if (naettAtomicLoad(&numCrossClientWaiters) > 0) {
+        naettMutexLock(&crossClientLock);
+        naettCondBroadcast(&crossClientSignal);
+        naettMutexUnlock(&crossClientLock);
+    }
+}
+
+void naettCompleteResponses(InternalResponse* first) {
+    completeResponses(first, 1);
+}
+
+void naettCompleteResponse(InternalResponse* res) {
+    if (naettAtomicLoad(&res->complete)) {
+        return;
+    }
+    res->nextCompleted = NULL;
+    naettCompleteResponses(res);
+}
+
+static int findCompleted(naettRes** responses, int numResponses) {
+    for (int i = 0; i < numResponses; i++) {
+        if (naettAtomicLoad(&((InternalResponse*)responses[i])->complete)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static long long currentTimeMS(void) {
+#if __WINDOWS__
+    return (long long)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+// Waits for a completion signal for at most `timeoutMS`, or forever if negative.
+// Must be called with `lock` held.
+static void waitForCompletionSignal(naettCond* signal, naettMutex* lock, int timeoutMS) {
+#if __WINDOWS__
+    DWORD waitMS = timeoutMS < 0 ? INFINITE : (DWORD)timeoutMS;
+    SleepConditionVariableSRW(signal, lock, waitMS, 0);
+#else
+    if (timeoutMS < 0) {
+        pthread_cond_wait(signal, lock);
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMS / 1000;
+    deadline.tv_nsec += (long)(timeoutMS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(signal, lock, &deadline);
+#endif
+}
+
 // Public API
 
 void naettInit(naettInitData initData) {
+    naettConfig config = { 0 };
+    naettInitWithConfig(initData, &config);
+}
+
+void naettInitWithConfig(naettInitData initData, const naettConfig* config) {
     assert(!initialized);
+    assert(config != NULL);
+    naettMutexInit(&crossClientLock);
+    naettCondInit(&crossClientSignal);
     naettPlatformInit(initData);
+    defaultClient = createClient(config);
+    assert(defaultClient != NULL);
     initialized = 1;
 }
 
+naettClient* naettClientCreate(const naettConfig* config) {
+    assert(initialized);
+    assert(config != NULL);
+    return (naettClient*)createClient(config);
+}
+
+void naettClientFree(naettClient* client) {
+    assert(client != NULL);
+    InternalClient* cli = (InternalClient*)client;
+    assert(cli != defaultClient);
+    naettPlatformFreeClient(cli);
+    naettMutexDestroy(&cli->admissionLock);
+    naettMutexDestroy(&cli->completionLock);
+    naettCondDestroy(&cli->completionSignal);
+    free((void*)cli->config.userAgent);
+    free(cli);
+}
+
 naettOption* naettMethod(const char* method) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -161,6 +569,30 @@ naettOption* naettUserAgent(const char* userAgent) {
     return (naettOption*)option;
 }
 
+naettOption* naettHTTPVersion(int version) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = version;
+    param->offset = offsetof(RequestOptions, httpVersion);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettUseClient(naettClient* client) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->ptr = client;
+    param->offset = offsetof(RequestOptions, client);
+    param->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettTimeout(int timeoutMS) {
     naettAlloc(InternalOption, option);
     option->numParams = 1;
@@ -173,7 +605,65 @@ naettOption* naettTimeout(int timeoutMS) {
     return (naettOption*)option;
 }
 
+naettOption* naettDeadline(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, deadlineMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettFirstByteTimeout(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, firstByteTimeoutMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettIdleTimeout(int milliSeconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 1;
+    InternalParam* param = &option->params[0];
+
+    param->integer = milliSeconds;
+    param->offset = offsetof(RequestOptions, idleTimeoutMS);
+    param->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettLowSpeed(int bytesPerSecond, int seconds) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* speedParam = &option->params[0];
+    InternalParam* timeParam = &option->params[1];
+
+    speedParam->integer = bytesPerSecond;
+    speedParam->offset = offsetof(RequestOptions, lowSpeedBytesPerSecond);
+    speedParam->setter = intSetter;
+
+    timeParam->integer = seconds;
+    timeParam->offset = offsetof(RequestOptions, lowSpeedSeconds);
+    timeParam->setter = intSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettBody(const char* body, int size) {
+    return naettBody64(body, size);
+}
+
+naettOption* naettBody64(const char* body, long long size) {
     naettAlloc(InternalOption, option);
     option->numParams = 2;
 
@@ -184,9 +674,9 @@ naettOption* naettBody(const char* body, int size) {
     bodyParam->offset = offsetof(RequestOptions, body) + offsetof(Buffer, data);
     bodyParam->setter = ptrSetter;
 
-    sizeParam->integer = size;
+    sizeParam->integer64 = size;
     sizeParam->offset = offsetof(RequestOptions, body) + offsetof(Buffer, size);
-    sizeParam->setter = intSetter;
+    sizeParam->setter = int64Setter;
 
     return (naettOption*)option;
 }
@@ -209,6 +699,42 @@ naettOption* naettBodyReader(naettReadFunc reader, void* userData) {
     return (naettOption*)option;
 }
 
+naettOption* naettBodyReader64(naettReadFunc64 reader, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* readerParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    readerParam->func = (void (*)(void)) reader;
+    readerParam->offset = offsetof(RequestOptions, bodyReader64);
+    readerParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, bodyReaderData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
+naettOption* naettOnComplete(naettCompleteFunc callback, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* callbackParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    callbackParam->func = (void (*)(void)) callback;
+    callbackParam->offset = offsetof(RequestOptions, onComplete);
+    callbackParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, onCompleteData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     naettAlloc(InternalOption, option);
     option->numParams = 2;
@@ -227,17 +753,63 @@ naettOption* naettBodyWriter(naettWriteFunc writer, void* userData) {
     return (naettOption*)option;
 }
 
+naettOption* naettBodyWriter64(naettWriteFunc64 writer, void* userData) {
+    naettAlloc(InternalOption, option);
+    option->numParams = 2;
+
+    InternalParam* writerParam = &option->params[0];
+    InternalParam* dataParam = &option->params[1];
+
+    writerParam->func = (void(*)(void)) writer;
+    writerParam->offset = offsetof(RequestOptions, bodyWriter64);
+    writerParam->setter = ptrSetter;
+
+    dataParam->ptr = userData;
+    dataParam->offset = offsetof(RequestOptions, bodyWriterData);
+    dataParam->setter = ptrSetter;
+
+    return (naettOption*)option;
+}
+
 void setupDefaultRW(InternalRequest* req) {
-    if (req->options.bodyReader == NULL) {
-        req->options.bodyReader = defaultBodyReader;
+    if (req->options.bodyReader == NULL && req->options.bodyReader64 == NULL) {
+        req->options.bodyReader64 = defaultBodyReader;
         req->options.bodyReaderData = (void*) &req->options.body;
     }
-    if (req->options.bodyReader == defaultBodyReader) {
+    if (req->options.bodyReader64 == defaultBodyReader) {
         req->options.body.position = 0;
     }
-    if (req->options.bodyWriter == NULL) {
-        req->options.bodyWriter = defaultBodyWriter;
+    if (req->options.bodyWriter == NULL && req->options.bodyWriter64 == NULL) {
+        req->options.bodyWriter64 = defaultBodyWriter;
+    }
+}
+
+long long naettReadBody(const InternalRequest* req, void* readerData, void* dest, long long bufferSize) {
+    if (req->options.bodyReader64 != NULL) {
+        return req->options.bodyReader64(dest, bufferSize, readerData);
+    }
+    return req->options.bodyReader(dest, bufferSize > INT_MAX ? INT_MAX : (int)bufferSize, readerData);
+}
+
+long long naettWriteBody(const InternalRequest* req, void* writerData, const void* source, long long bytes) {
+    if (req->options.bodyWriter64 != NULL) {
+        return req->options.bodyWriter64(source, bytes, writerData);
+    }
+    // Chunks from the platform are far below 2 GiB
+    return req->options.bodyWriter(source, (int)bytes, writerData);
+}
+
+// Applies defaults and initializes the platform part of a configured request.
+static naettReq* finishRequest(InternalRequest* req) {
+    applyClientDefaults(req);
+    setupDefaultRW(req);
+
+    if (naettPlatformInitRequest(req)) {
+        return (naettReq*)req;
     }
+
+    naettFree((naettReq*) req);
+    return NULL;
 }
 
 naettReq* naettRequest_va(const char* url, int numArgs, ...) {
@@ -256,14 +828,7 @@ naettReq* naettRequest_va(const char* url, int numArgs, ...) {
     }
     va_end(args);
 
-    setupDefaultRW(req);
-
-    if (naettPlatformInitRequest(req)) {
-        return (naettReq*)req;
-    }
-
-    naettFree((naettReq*) req);
-    return NULL;
+    return finishRequest(req);
 }
 
 naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOption** options) {
@@ -279,9 +844,71 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
         free(option);
     }
 
-    setupDefaultRW(req);
+    return finishRequest(req);
+}
 
-    if (naettPlatformInitRequest(req)) {
+naettReq* naettRequestWithConfig(const char* url, const naettRequestConfig* config) {
+    assert(url != NULL);
+    assert(config != NULL);
+    assert(config->numHeaders == 0 || config->headers != NULL);
+
+    naettAlloc(InternalRequest, req);
+    initRequest(req, url);
+    RequestOptions* options = &req->options;
+
+    if (config->method != NULL) {
+        free((void*)options->method);
+        options->method = strdup(config->method);
+    }
+    if (config->userAgent != NULL) {
+        options->userAgent = strdup(config->userAgent);
+    }
+    for (int i = 0; i < config->numHeaders; i++) {
+        addKV(&options->headers, config->headers[i].name, config->headers[i].value);
+    }
+    options->body.data = (void*)config->body;
+    options->body.size = config->bodySize;
+    options->bodyReader = config->bodyReader;
+    options->bodyReader64 = config->bodyReader64;
+    options->bodyReaderData = config->bodyReaderData;
+    options->bodyWriter = config->bodyWriter;
+    options->bodyWriter64 = config->bodyWriter64;
+    options->bodyWriterData = config->bodyWriterData;
+    options->onComplete = config->onComplete;
+    options->onCompleteData = config->onCompleteData;
+    if (config->timeoutMS > 0) {
+        options->timeoutMS = config->timeoutMS;
+    }
+    options->deadlineMS = config->deadlineMS;
+    options->firstByteTimeoutMS = config->firstByteTimeoutMS;
+    options->idleTimeoutMS = config->idleTimeoutMS;
+    options->lowSpeedBytesPerSecond = config->lowSpeedBytesPerSecond;
+    options->lowSpeedSeconds = config->lowSpeedSeconds;
+    options->httpVersion = config->httpVersion;
+    options->client = (InternalClient*)config->client;
+
+    return finishRequest(req);
+}
+
+naettReq* naettReqClone(naettReq* request, const char* url) {
+    assert(request != NULL);
+    assert(url != NULL);
+
+    InternalRequest* source = (InternalRequest*)request;
+    naettAlloc(InternalRequest, req);
+
+    // Options are already resolved, including client defaults. Their strings never
+    // change after creation, so they are shared rather than copied.
+    req->options = source->options;
+    req->options.body.position = 0;
+    if (req->options.bodyReader64 == defaultBodyReader) {
+        req->options.bodyReaderData = (void*) &req->options.body;
+    }
+    req->refCount = source->refCount;
+    naettAtomicAdd(req->refCount, 1);
+    req->url = strdup(url);
+
+    if (naettPlatformCloneRequest(req, source)) {
         return (naettReq*)req;
     }
 
@@ -289,23 +916,92 @@ naettReq* naettRequestWithOptions(const char* url, int numOptions, const naettOp
     return NULL;
 }
 
-naettRes* naettMake(naettReq* request) {
-    assert(initialized);
+int naettSetURL(naettReq* request, const char* url) {
     assert(request != NULL);
+    assert(url != NULL);
 
     InternalRequest* req = (InternalRequest*)request;
+    const char* previousURL = req->url;
+    req->url = strdup(url);
+
+    if (!naettPlatformSetURL(req)) {
+        free((void*)req->url);
+        req->url = previousURL;
+        return 0;
+    }
+    free((void*)previousURL);
+    return 1;
+}
+
+static InternalResponse* createResponse(InternalRequest* req) {
     naettAlloc(InternalResponse, res);
     res->request = req;
 
-    if (req->options.bodyWriter == defaultBodyWriter) {
-        req->options.bodyWriterData = (void*) &res->body;
+    res->bodyReaderData = req->options.bodyReaderData;
+    if (req->options.bodyReader64 == defaultBodyReader) {
+        res->requestBody = req->options.body;
+        res->requestBody.position = 0;
+        res->bodyReaderData = (void*) &res->requestBody;
     }
+    res->bodyWriterData = req->options.bodyWriterData;
+    if (req->options.bodyWriter64 == defaultBodyWriter) {
+        res->bodyWriterData = (void*) &res->body;
+    }
+    return res;
+}
 
-    naettPlatformMakeRequest(res);
+naettRes* naettMake(naettReq* request) {
+    assert(initialized);
+    assert(request != NULL);
+
+    InternalRequest* req = (InternalRequest*)request;
+    InternalResponse* res = createResponse(req);
+
+    if (admitResponse(req->options.client, res)) {
+        naettPlatformMakeRequest(res);
+    }
     return (naettRes*) res;
 }
 
+void naettMakeBatch(naettReq** requests, int numRequests, naettRes** responses) {
+    assert(initialized);
+    assert(numRequests == 0 || (requests != NULL && responses != NULL));
+
+    InternalResponse* batch = NULL;
+    InternalResponse** link = &batch;
+
+    for (int i = 0; i < numRequests; i++) {
+        assert(requests[i] != NULL);
+        InternalRequest* req = (InternalRequest*)requests[i];
+        InternalResponse* res = createResponse(req);
+        responses[i] = (naettRes*)res;
+
+        if (admitResponse(req->options.client, res)) {
+            *link = res;
+            link = &res->nextQueued;
+        }
+    }
+    *link = NULL;
+
+    if (batch != NULL) {
+        naettPlatformMakeRequests(batch);
+    }
+}
+
+static int clampSize(long long size) {
+    return size > INT_MAX ? INT_MAX : (int)size;
+}
+
 const void* naettGetBody(naettRes* response, int* size) {
+    assert(size != NULL);
+
+    long long size64 = 0;
+    const void* body = naettGetBody64(response, &size64);
+    *size = clampSize(size64);
+    return body;
+}
+
+const void* naettGetBody64(naettRes* response, long long* size) {
     assert(response != NULL);
     assert(size != NULL);
 
@@ -315,6 +1011,15 @@ const void* naettGetBody(naettRes* response, int* size) {
 }
 
 int naettGetTotalBytesRead(naettRes* response, int* totalSize) {
+    assert(totalSize != NULL);
+
+    long long totalSize64 = 0;
+    long long bytesRead = naettGetTotalBytesRead64(response, &totalSize64);
+    *totalSize = clampSize(totalSize64);
+    return clampSize(bytesRead);
+}
+
+long long naettGetTotalBytesRead64(naettRes* response, long long* totalSize) {
     assert(response != NULL);
     assert(totalSize != NULL);
 
@@ -323,32 +1028,286 @@ int naettGetTotalBytesRead(naettRes* response, int* totalSize) {
     return res->totalBytesRead;
 }
 
-const char* naettGetHeader(naettRes* response, const char* name) {
+// Fits the typical set of response headers in one block.
+#define arenaBlockSize 2048
+#define arenaAlign(SIZE) (((SIZE) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+void* naettArenaAlloc(Arena* arena, size_t size) {
+    size = arenaAlign(size);
+    ArenaBlock* block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = block != NULL ? block->size * 2 : arenaBlockSize;
+        while (blockSize < size) {
+            blockSize *= 2;
+        }
+        ArenaBlock* newBlock = (ArenaBlock*)malloc(arenaAlign(sizeof(ArenaBlock)) + blockSize);
+        if (newBlock == NULL) {
+            return NULL;
+        }
+        newBlock->next = block;
+        newBlock->size = blockSize;
+        newBlock->used = 0;
+        arena->blocks = block = newBlock;
+    }
+    void* result = (char*)block + arenaAlign(sizeof(ArenaBlock)) + block->used;
+    block->used += size;
+    return result;
+}
+
+void naettArenaFree(Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+static unsigned int hashHeaderName(const char* name, size_t length) {
+    // FNV-1a over the ASCII lower case name
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+static int sameHeaderName(const HeaderEntry* entry, const char* name, size_t length, unsigned int hash) {
+    if (entry->hash != hash || entry->nameLength != length) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned char a = (unsigned char)entry->name[i];
+        unsigned char b = (unsigned char)name[i];
+        if (a != b && ((a | 0x20) != (b | 0x20) || (a | 0x20) < 'a' || (a | 0x20) > 'z')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void indexHeader(HeaderTable* table, int entryIndex) {
+    const HeaderEntry* entry = &table->entries[entryIndex];
+    unsigned int mask = (unsigned int)table->capacity * 2 - 1;
+    unsigned int slot = entry->hash & mask;
+    while (table->slots[slot] != 0 &&
+           !sameHeaderName(&table->entries[table->slots[slot] - 1], entry->name, entry->nameLength, entry->hash)) {
+        slot = (slot + 1) & mask;
+    }
+    // Later headers replace earlier ones of the same name
+    table->slots[slot] = entryIndex + 1;
+}
+
+static int growHeaderTable(Arena* arena, HeaderTable* table) {
+    int capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+    HeaderEntry* entries = (HeaderEntry*)naettArenaAlloc(arena, capacity * sizeof(HeaderEntry));
+    int* slots = (int*)naettArenaAlloc(arena, capacity * 2 * sizeof(int));
+    if (entries == NULL || slots == NULL) {
+        return 0;
+    }
+    if (table->count > 0) {
+        memcpy(entries, table->entries, table->count * sizeof(HeaderEntry));
+    }
+    memset(slots, 0, capacity * 2 * sizeof(int));
+    // The old arrays stay in the arena until the response is closed
+    table->entries = entries;
+    table->slots = slots;
+    table->capacity = capacity;
+    for (int i = 0; i < table->count; i++) {
+        indexHeader(table, i);
+    }
+    return 1;
+}
+
+void naettAddHeader(InternalResponse* res, const char* name, size_t nameLength, const char* value, size_t valueLength) {
+    HeaderTable* table = &res->headers;
+    if (table->count == table->capacity && !growHeaderTable(&res->arena, table)) {
+        return;
+    }
+    // Name and value in one piece
+    char* strings = (char*)naettArenaAlloc(&res->arena, nameLength + valueLength + 2);
+    if (strings == NULL) {
+        return;
+    }
+    memcpy(strings, name, nameLength);
+    strings[nameLength] = 0;
+    memcpy(strings + nameLength + 1, value, valueLength);
+    strings[nameLength + 1 + valueLength] = 0;
+
+    HeaderEntry* entry = &table->entries[table->count];
+    entry->name = strings;
+    entry->value = strings + nameLength + 1;
+    entry->nameLength = nameLength;
+    entry->hash = hashHeaderName(name, nameLength);
+    indexHeader(table, table->count++);
+}
+
+static void clearHeaders(HeaderTable* table) {
+    // Storage stays in the arena until the response is closed
+    if (table->capacity > 0) {
+        memset(table->slots, 0, table->capacity * 2 * sizeof(int));
+    }
+    table->count = 0;
+}
+
+static void foldHeader(InternalResponse* res, const char* value, size_t valueLength) {
+    HeaderTable* table = &res->headers;
+    if (table->count == 0 || valueLength == 0) {
+        return;
+    }
+    HeaderEntry* entry = &table->entries[table->count - 1];
+    size_t previousLength = strlen(entry->value);
+    char* folded = (char*)naettArenaAlloc(&res->arena, previousLength + valueLength + 2);
+    if (folded == NULL) {
+        return;
+    }
+    memcpy(folded, entry->value, previousLength);
+    folded[previousLength] = ' ';
+    memcpy(folded + previousLength + 1, value, valueLength);
+    folded[previousLength + 1 + valueLength] = 0;
+    entry->value = folded;
+}
+
+#if naettSSE2
+static int firstBit(int mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (int)index;
+#else
+    return __builtin_ctz((unsigned int)mask);
+#endif
+}
+#endif
+
+// Returns the offset of the first ':', CR or LF in `line`, or `length` if there is none.
+static size_t findHeaderDelimiter(const char* line, size_t length) {
+    size_t i = 0;
+#if naettSSE2
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(line + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, colon),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + firstBit(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        char c = line[i];
+        if (c == ':' || c == '\r' || c == '\n') {
+            return i;
+        }
+    }
+    return length;
+}
+
+static int isHeaderSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+int naettParseHeaderLine(InternalResponse* res, const char* line, size_t length) {
+    if (length == 0 || line[0] == '\r' || line[0] == '\n') {
+        // End of headers
+        return 1;
+    }
+    if (length >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        // Interim and redirect responses are followed by a new status line and headers
+        clearHeaders(&res->headers);
+        return 0;
+    }
+
+    const char* end = line + length;
+    while (end > line && (end[-1] == '\r' || end[-1] == '\n' || isHeaderSpace(end[-1]))) {
+        end--;
+    }
+
+    if (isHeaderSpace(line[0])) {
+        // Obsolete line folding, continues the previous header value
+        const char* value = line;
+        while (value < end && isHeaderSpace(*value)) {
+            value++;
+        }
+        foldHeader(res, value, end - value);
+        return 0;
+    }
+
+    size_t split = findHeaderDelimiter(line, end - line);
+    if (split == 0 || line + split == end || line[split] != ':') {
+        // Not a header
+        return 0;
+    }
+    const char* value = line + split + 1;
+    while (value < end && isHeaderSpace(*value)) {
+        value++;
+    }
+    naettAddHeader(res, line, split, value, end - value);
+    return 0;
+}
+
+void naettHeadersReceived(InternalResponse* res) {
+    const char* value = naettGetHeader((naettRes*)res, "Content-Length");
+    char* end = NULL;
+    long long length = value != NULL ? strtoll(value, &end, 10) : -1;
+    if (value == NULL || end == value || *end != 0 || length < 0 || length == LLONG_MAX) {
+        res->contentLength = -1;
+        return;
+    }
+    res->contentLength = length;
+
+    InternalRequest* req = res->request;
+    if (res->bodyWriterData == (void*)&res->body && strcmp(req->options.method, "HEAD") != 0) {
+        long long maxPreallocation = req->options.client->config.maxBodyPreallocation;
+        reserveBody(&res->body, maxPreallocation < res->contentLength ? maxPreallocation : res->contentLength);
+    }
+}
+
+const char* naettGetHeaderN(naettRes* response, const char* name, int nameLength) {
     assert(response != NULL);
     assert(name != NULL);
+    assert(nameLength >= 0);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (strcasecmp(name, node->key) == 0) {
-            return node->value;
+    const HeaderTable* table = &res->headers;
+    if (table->count == 0) {
+        return NULL;
+    }
+    unsigned int hash = hashHeaderName(name, nameLength);
+    unsigned int mask = (unsigned int)table->capacity * 2 - 1;
+    for (unsigned int slot = hash & mask; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const HeaderEntry* entry = &table->entries[table->slots[slot] - 1];
+        if (sameHeaderName(entry, name, nameLength, hash)) {
+            return entry->value;
         }
-        node = node->next;
     }
     return NULL;
 }
 
+const char* naettGetHeader(naettRes* response, const char* name) {
+    assert(name != NULL);
+    return naettGetHeaderN(response, name, (int)strlen(name));
+}
+
 void naettListHeaders(naettRes* response, naettHeaderLister lister, void* userData) {
     assert(response != NULL);
     assert(lister != NULL);
 
     InternalResponse* res = (InternalResponse*)response;
-    KVLink* node = res->headers;
-    while (node) {
-        if (!lister(node->key, node->value, userData)) {
+    const HeaderTable* table = &res->headers;
+    // Latest first
+    for (int i = table->count - 1; i >= 0; i--) {
+        if (!lister(table->entries[i].name, table->entries[i].value, userData)) {
             return;
         }
-        node = node->next;
     }
 }
 
@@ -361,7 +1320,100 @@ naettReq* naettGetRequest(naettRes* response) {
 int naettComplete(const naettRes* response) {
     assert(response != NULL);
     InternalResponse* res = (InternalResponse*)response;
-    return res->complete;
+    return naettAtomicLoad(&res->complete);
+}
+
+int naettWait(naettRes* response, int timeoutMS) {
+    assert(response != NULL);
+    int index = 0;
+    return naettWaitAny(&response, 1, timeoutMS, &index);
+}
+
+int naettWaitAny(naettRes** responses, int numResponses, int timeoutMS, int* index) {
+    assert(initialized);
+    assert(responses != NULL);
+    assert(index != NULL);
+
+    long long deadline = currentTimeMS() + timeoutMS;
+
+    // Responses of a single client are waited for on its own signal.
+    InternalClient* client = NULL;
+    for (int i = 0; i < numResponses; i++) {
+        InternalClient* responseClient = ((InternalResponse*)responses[i])->request->options.client;
+        if (i > 0 && responseClient != client) {
+            client = NULL;
+            break;
+        }
+        client = responseClient;
+    }
+    naettMutex* lock = client ? &client->completionLock : &crossClientLock;
+    naettCond* signal = client ? &client->completionSignal : &crossClientSignal;
+    if (client == NULL) {
+        naettAtomicAdd(&numCrossClientWaiters, 1);
+    }
+
+    naettMutexLock(lock);
+    int found = findCompleted(responses, numResponses);
+    while (found < 0) {
+        int waitMS = -1;
+        if (timeoutMS >= 0) {
+            long long timeLeft = deadline - currentTimeMS();
+            if (timeLeft <= 0) {
+                break;
+            }
+            waitMS = (int)timeLeft;
+        }
+        waitForCompletionSignal(signal, lock, waitMS);
+        found = findCompleted(responses, numResponses);
+    }
+    naettMutexUnlock(lock);
+
+    if (client == NULL) {
+        naettAtomicAdd(&numCrossClientWaiters, -1);
+    }
+
+    if (found < 0) {
+        return 0;
+    }
+    *index = found;
+    return 1;
+}
+
+int naettClientCompletionFD(naettClient* client) {
+    assert(initialized);
+    assert(client != NULL);
+    return naettPlatformCompletionFD((InternalClient*)client);
+}
+
+int naettClientGetCompleted(naettClient* client, naettRes** responses, int maxResponses) {
+    assert(initialized);
+    assert(client != NULL);
+    assert(maxResponses == 0 || responses != NULL);
+    InternalClient* cli = (InternalClient*)client;
+
+    naettMutexLock(&cli->completionLock);
+    int count = 0;
+    while (count < maxResponses && cli->firstCompleted != NULL) {
+        InternalResponse* res = cli->firstCompleted;
+        dequeueCompletion(cli, res);
+        responses[count++] = (naettRes*)res;
+    }
+    if (count > 0 && cli->firstCompleted == NULL) {
+        naettPlatformSignalCompletion(cli, 0);
+    }
+    naettMutexUnlock(&cli->completionLock);
+
+    return count;
+}
+
+int naettCompletionFD(void) {
+    assert(initialized);
+    return naettClientCompletionFD((naettClient*)defaultClient);
+}
+
+int naettGetCompleted(naettRes** responses, int maxResponses) {
+    assert(initialized);
+    return naettClientGetCompleted((naettClient*)defaultClient, responses, maxResponses);
 }
 
 int naettGetStatus(const naettRes* response) {
@@ -385,21 +1437,68 @@ void naettFree(naettReq* request) {
 
     InternalRequest* req = (InternalRequest*)request;
     naettPlatformFreeRequest(req);
-    KVLink* node = req->options.headers;
-    freeKVList(node);
-    free((void*)req->options.method);
+    if (naettAtomicAdd(req->refCount, -1) == 0) {
+        naettPlatformFreeSharedRequest(req);
+        KVLink* node = req->options.headers;
+        freeKVList(node);
+        free((void*)req->options.method);
+        free((void*)req->options.userAgent);
+        free(req->refCount);
+    }
     free((void*)req->url);
     free(request);
 }
 
-void naettClose(naettRes* response) {
-    assert(response != NULL);
+static void freeResponse(InternalResponse* res) {
+    InternalClient* client = res->request->options.client;
+    naettMutexLock(&client->completionLock);
+    if (isQueuedCompletion(client, res)) {
+        dequeueCompletion(client, res);
+        if (client->firstCompleted == NULL) {
+            naettPlatformSignalCompletion(client, 0);
+        }
+    }
+    naettMutexUnlock(&client->completionLock);
 
-    InternalResponse* res = (InternalResponse*)response;
     res->request = NULL;
     naettPlatformCloseResponse(res);
-    KVLink* node = res->headers;
-    freeKVList(node);
+    naettArenaFree(&res->arena);
     free(res->body.data);
-    free(response);
+    free(res);
+}
+
+void naettCancel(naettRes* response) {
+    assert(response != NULL);
+
+    InternalResponse* res = (InternalResponse*)response;
+    // Completed responses are neither queued nor running, see `naettCompleteResponses`.
+    if (unqueueAdmission(res)) {
+        // Never started
+        res->code = naettCancelledError;
+        naettCompleteResponse(res);
+        return;
+    }
+    if (naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferCancelled)) {
+        naettPlatformCancelResponse(res);
+    }
+}
+
+void naettClose(naettRes* response) {
+    assert(response != NULL);
+
+    InternalResponse* res = (InternalResponse*)response;
+    for (;;) {
+        if (naettAtomicCAS(&res->closeState, naettInCallback, naettInCallback | naettClosing)) {
+            // The completion callback is running, and frees the response when it returns.
+            return;
+        }
+        if (naettAtomicCAS(&res->closeState, 0, naettClosing)) {
+            // From now on the completion callback is not called
+            break;
+        }
+    }
+    // If the platform still holds on to the response, wait until it lets go.
+    naettCancel(response);
+    naettWait(response, -1);
+    freeResponse(res);
 }
@@ -1,6 +1,8 @@
 #ifndef NAETT_INTERNAL_H
 #define NAETT_INTERNAL_H
 
+#include <stddef.h>
+
 #ifdef _MSC_VER
     #define strcasecmp _stricmp
     #undef strdup
@@ -38,6 +40,38 @@
 #endif
 #endif
 
+#if __WINDOWS__
+typedef SRWLOCK naettMutex;
+typedef CONDITION_VARIABLE naettCond;
+#define naettMutexInit(MUTEX) InitializeSRWLock(MUTEX)
+#define naettMutexLock(MUTEX) AcquireSRWLockExclusive(MUTEX)
+#define naettMutexUnlock(MUTEX) ReleaseSRWLockExclusive(MUTEX)
+#define naettMutexDestroy(MUTEX) ((void)(MUTEX))
+#define naettCondInit(COND) InitializeConditionVariable(COND)
+#define naettCondBroadcast(COND) WakeAllConditionVariable(COND)
+#define naettCondDestroy(COND) ((void)(COND))
+#define naettAtomicCAS(PTR, EXPECTED, DESIRED) \
+    (InterlockedCompareExchange((volatile LONG*)(PTR), (DESIRED), (EXPECTED)) == (EXPECTED))
+#define naettAtomicLoad(PTR) InterlockedCompareExchange((volatile LONG*)(PTR), 0, 0)
+#define naettAtomicStore(PTR, VALUE) InterlockedExchange((volatile LONG*)(PTR), (VALUE))
+#define naettAtomicAdd(PTR, VALUE) (InterlockedExchangeAdd((volatile LONG*)(PTR), (VALUE)) + (VALUE))
+#else
+#include <pthread.h>
+typedef pthread_mutex_t naettMutex;
+typedef pthread_cond_t naettCond;
+#define naettMutexInit(MUTEX) pthread_mutex_init(MUTEX, NULL)
+#define naettMutexLock(MUTEX) pthread_mutex_lock(MUTEX)
+#define naettMutexUnlock(MUTEX) pthread_mutex_unlock(MUTEX)
+#define naettMutexDestroy(MUTEX) pthread_mutex_destroy(MUTEX)
+#define naettCondInit(COND) pthread_cond_init(COND, NULL)
+#define naettCondBroadcast(COND) pthread_cond_broadcast(COND)
+#define naettCondDestroy(COND) pthread_cond_destroy(COND)
+#define naettAtomicCAS(PTR, EXPECTED, DESIRED) __sync_bool_compare_and_swap((PTR), (EXPECTED), (DESIRED))
+#define naettAtomicLoad(PTR) __atomic_load_n((PTR), __ATOMIC_SEQ_CST)
+#define naettAtomicStore(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define naettAtomicAdd(PTR, VALUE) __atomic_add_fetch((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#endif
+
 #define naettAlloc(TYPE, VAR) TYPE* VAR = (TYPE*)calloc(1, sizeof(TYPE))
 
 typedef struct KVLink {
@@ -46,21 +80,87 @@ typedef struct KVLink {
     struct KVLink* next;
 } KVLink;
 
+// Bump allocator for data living as long as a response, such as its headers.
+// Blocks are only freed all at once, when the response is closed.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* blocks;
+} Arena;
+
+typedef struct HeaderEntry {
+    const char* name;
+    const char* value;
+    size_t nameLength;
+    unsigned int hash;  // Of the lower case name
+} HeaderEntry;
+
+// Response headers in arrival order, indexed by an open addressing hash table
+// of `2 * capacity` slots, each holding an entry index + 1, or 0 if empty.
+// A slot refers to the latest header of its name. All storage is in the response arena.
+typedef struct HeaderTable {
+    HeaderEntry* entries;
+    int* slots;
+    int count;
+    int capacity;
+} HeaderTable;
+
 typedef struct Buffer {
     void* data;
-    int size;
-    int capacity;
-    int position;
+    long long size;
+    long long capacity;
+    long long position;
 } Buffer;
 
+typedef struct InternalClient {
+    naettConfig config;
+    // Admission control state, see `maxActive` and `maxQueued` in naettConfig.
+    naettMutex admissionLock;
+    int numActive;
+    int numQueued;
+    struct InternalResponse* firstQueued;
+    struct InternalResponse* lastQueued;
+    // Signalled when responses of the client complete. The lock protects the
+    // completion queue, and is held while responses are marked complete.
+    naettMutex completionLock;
+    naettCond completionSignal;
+    // Completed responses without completion callbacks, not yet collected by
+    // `naettClientGetCompleted`.
+    struct InternalResponse* firstCompleted;
+    struct InternalResponse* lastCompleted;
+#if __LINUX__
+    struct Worker* workers;
+    int numWorkers;
+    CURLSH* share;
+    int completionFD;
+    pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+#endif
+} InternalClient;
+
 typedef struct {
+    InternalClient* client;
     const char* method;
     const char* userAgent;
     int timeoutMS;
+    int deadlineMS;
+    int firstByteTimeoutMS;
+    int idleTimeoutMS;
+    int lowSpeedBytesPerSecond;
+    int lowSpeedSeconds;
+    int httpVersion;
+    // At most one of the plain and 64-bit variants is used, see `naettReadBody`.
     naettReadFunc bodyReader;
+    naettReadFunc64 bodyReader64;
     void* bodyReaderData;
     naettWriteFunc bodyWriter;
+    naettWriteFunc64 bodyWriter64;
     void* bodyWriterData;
+    naettCompleteFunc onComplete;
+    void* onCompleteData;
     KVLink* headers;
     Buffer body;
 } RequestOptions;
@@ -68,29 +168,77 @@ typedef struct {
 typedef struct {
     RequestOptions options;
     const char* url;
+    // Number of requests sharing the strings and header list of the options, and the
+    // platform state that does not depend on the URL, see `naettReqClone`.
+    // Only changed with naettAtomicAdd.
+    int* refCount;
 #if __APPLE__
     id urlRequest;
 #endif
 #if __ANDROID__
     jobject urlObject;
 #endif
+#if __LINUX__
+    unsigned int hostHash;
+    // Built once, shared read-only by all responses to this request and its clones.
+    struct curl_slist* headerList;
+#endif
 #if __WINDOWS__
     HINTERNET session;
     HINTERNET connection;
-    HINTERNET request;
     LPWSTR host;
     LPWSTR resource;
+    LPWSTR verb;
+    LPWSTR headers;
+    DWORD openFlags;
 #endif
 } InternalRequest;
 
-typedef struct {
+// Values of `InternalResponse.cancelState`, only changed with naettAtomicCAS.
+enum {
+    naettTransferRunning = 0,
+    naettTransferCancelled,
+    // Completing normally, too late to cancel.
+    naettTransferFinishing,
+};
+
+// Flags of `InternalResponse.closeState`, only changed with naettAtomicCAS.
+enum {
+    // The completion callback is running.
+    naettInCallback = 1,
+    // `naettClose` has been called. Set during the callback, the thread running it frees the response.
+    naettClosing = 2,
+};
+
+typedef struct InternalResponse {
     InternalRequest* request;
     int code;
+    // Set with the completion lock of the client held, and read with naettAtomicLoad.
     int complete;
-    KVLink* headers;
+    int cancelState;
+    int closeState;
+    // Set while the response holds an admission slot of its client.
+    int admitted;
+    // Set while the response waits in the admission queue of its client. Changed with the
+    // admission lock held, and read without it with naettAtomicLoad.
+    int queued;
+    // Links in the admission queue, or in a batch passed to naettPlatformMakeRequests.
+    struct InternalResponse* nextQueued;
+    struct InternalResponse* prevQueued;
+    // See `naettAddHeader`.
+    HeaderTable headers;
+    Arena arena;
     Buffer body;
-    int contentLength;  // 0 if headers not read, -1 if Content-Length missing.
-    int totalBytesRead;
+    // Per response state of the request body reader and response body writer,
+    // so that a request can be made many times concurrently.
+    Buffer requestBody;
+    void* bodyReaderData;
+    void* bodyWriterData;
+    long long contentLength;  // 0 if headers not read, -1 if Content-Length missing.
+    long long totalBytesRead;
+    // Links in the completion queue of the client, or in a batch passed to naettCompleteResponses.
+    struct InternalResponse* nextCompleted;
+    struct InternalResponse* prevCompleted;
 #if __APPLE__
     id session;
 #endif
@@ -99,18 +247,81 @@ typedef struct {
     int closeRequested;
 #endif
 #if __LINUX__
-    struct curl_slist* headerList;
+    struct InternalResponse* nextSubmitted;
+    struct InternalResponse* nextCancelled;
+    // Worker thread only. The easy handle while the transfer is running, and
+    // whether the worker has taken the response off the submission stack.
+    CURL* handle;
+    int added;
+    // Worker thread only. Links in the worker's list of transfers with timeouts,
+    // see `naettDeadline`, `naettFirstByteTimeout` and `naettIdleTimeout`.
+    struct InternalResponse* nextTimed;
+    struct InternalResponse* prevTimed;
+    int timed;
+    int receivedData;
+    long long startMS;
+    long long lastReceiveMS;
+    // Worker thread only. CLOCK_MONOTONIC time in nanoseconds at which the transfer
+    // was added to the multi handle, for measuring dispatch latency.
+    long long addedNS;
 #endif
 #if __WINDOWS__
+    HINTERNET handle;
     char buffer[10240];
     size_t bytesLeft;
 #endif
 } InternalResponse;
 
 void naettPlatformInit(naettInitData initData);
+int naettPlatformInitClient(InternalClient* client);
+void naettPlatformFreeClient(InternalClient* client);
 int naettPlatformInitRequest(InternalRequest* req);
+// Updates the platform state of an initialized request after its URL changed.
+// Returns 0 if the URL is not usable, leaving the previous state in place.
+int naettPlatformSetURL(InternalRequest* req);
+// Initializes the platform state of a copy of `source` with a different URL, see `naettReqClone`.
+// Returns 0 if the URL is not usable.
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source);
 void naettPlatformMakeRequest(InternalResponse* res);
+// Makes a list of requests, linked through `nextQueued`.
+void naettPlatformMakeRequests(InternalResponse* first);
 void naettPlatformFreeRequest(InternalRequest* req);
+// Frees the platform state shared by a request and its clones, once the last of them is freed.
+void naettPlatformFreeSharedRequest(InternalRequest* req);
 void naettPlatformCloseResponse(InternalResponse* res);
+// Aborts a running request, which completes with `naettCancelledError`.
+// Called at most once per response.
+void naettPlatformCancelResponse(InternalResponse* res);
+int naettPlatformCompletionFD(InternalClient* client);
+// Makes the completion descriptor of a client readable, or not.
+void naettPlatformSignalCompletion(InternalClient* client, int pending);
+
+// Returns pointer aligned, uninitialized memory that stays valid until `naettArenaFree`.
+void* naettArenaAlloc(Arena* arena, size_t size);
+void naettArenaFree(Arena* arena);
+
+// Adds a response header, copying name and value into the response arena.
+// Neither needs to be zero terminated.
+void naettAddHeader(InternalResponse* res, const char* name, size_t nameLength, const char* value, size_t valueLength);
+
+// Calls the body reader or writer of a request, whichever variant is set, with
+// per response reader or writer data.
+long long naettReadBody(const InternalRequest* req, void* readerData, void* dest, long long bufferSize);
+long long naettWriteBody(const InternalRequest* req, void* writerData, const void* source, long long bytes);
+
+// Parses one header line, with or without its line ending, into the response headers.
+// A status line starts over with a new set of headers, as after a redirect or an interim
+// response, and lines starting with whitespace continue the previous header value.
+// Duplicate headers are all kept, with `naettGetHeader` finding the latest.
+// Returns 1 for the empty line ending a set of headers, 0 otherwise.
+int naettParseHeaderLine(InternalResponse* res, const char* line, size_t length);
+// Called when all headers are in. Sets `contentLength`, and reserves room for the body
+// in the default body buffer.
+void naettHeadersReceived(InternalResponse* res);
+
+// Marks a response as complete. Completing an already completed response does nothing.
+void naettCompleteResponse(InternalResponse* res);
+// Marks a list of pending responses, linked through `nextCompleted`, as complete.
+void naettCompleteResponses(InternalResponse* first);
 
 #endif  // NAETT_INTERNAL_H
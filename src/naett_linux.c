@@ -6,102 +6,565 @@
 #include <assert.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <string.h>
-
-static pthread_t workerThread;
-static int handleReadFD = 0;
-static int handleWriteFD = 0;
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+#define maxPooledHandles 64
+
+typedef struct Worker {
+    pthread_t thread;
+    CURLM* multi;
+    // Lock-free multi-producer, single-consumer stack of submitted responses.
+    // Producers push with a CAS, the worker takes the whole stack with one exchange.
+    InternalResponse* submissions;
+    // Responses to cancel, pushed the same way as submissions.
+    InternalResponse* cancellations;
+    // Cancellations that arrived before their submission. Only touched by the worker thread.
+    InternalResponse* deferredCancellations;
+    // Running transfers with timeouts checked by the worker. Only touched by the worker thread.
+    InternalResponse* timedTransfers;
+    // Set while a wakeup is pending, so that bursts of submissions only wake the worker once.
+    int wakeupPending;
+    int quit;
+    // Finished easy handles, reset and kept for reuse by new transfers.
+    // Only touched by the worker thread.
+    CURL* handlePool[maxPooledHandles];
+    int pooledHandles;
+} Worker;
 
 static void panic(const char* message) {
     fprintf(stderr, "%s\n", message);
     exit(1);
 }
 
-static void* curlWorker(void* data) {
-    CURLM* mc = (CURLM*)data;
-    int activeHandles = 0;
-    int messagesLeft = 1;
+static long long monotonicNS(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long long monotonicMS(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void wakeWorker(Worker* worker) {
+    if (!__atomic_exchange_n(&worker->wakeupPending, 1, __ATOMIC_SEQ_CST)) {
+        curl_multi_wakeup(worker->multi);
+    }
+}
+
+static void submit(Worker* worker, InternalResponse* first, InternalResponse* last) {
+    InternalResponse* head = __atomic_load_n(&worker->submissions, __ATOMIC_RELAXED);
+    do {
+        last->nextSubmitted = head;
+    } while (
+        !__atomic_compare_exchange_n(&worker->submissions, &head, first, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    wakeWorker(worker);
+}
+
+static void setupHandle(CURL* c, InternalResponse* res);
+
+static CURL* acquireHandle(Worker* worker) {
+    if (worker->pooledHandles > 0) {
+        return worker->handlePool[--worker->pooledHandles];
+    }
+    return curl_easy_init();
+}
+
+static void releaseHandle(Worker* worker, CURL* handle) {
+    if (worker->pooledHandles < maxPooledHandles) {
+        curl_easy_reset(handle);
+        worker->handlePool[worker->pooledHandles++] = handle;
+    } else {
+        curl_easy_cleanup(handle);
+    }
+}
+
+static void startTimers(Worker* worker, InternalResponse* res) {
+    RequestOptions* options = &res->request->options;
+    if (options->deadlineMS <= 0 && options->firstByteTimeoutMS <= 0 && options->idleTimeoutMS <= 0) {
+        return;
+    }
+
+    res->startMS = monotonicMS();
+    res->timed = 1;
+    res->prevTimed = NULL;
+    res->nextTimed = worker->timedTransfers;
+    if (worker->timedTransfers) {
+        worker->timedTransfers->prevTimed = res;
+    }
+    worker->timedTransfers = res;
+}
+
+static void addSubmitted(Worker* worker) {
+    __atomic_store_n(&worker->wakeupPending, 0, __ATOMIC_SEQ_CST);
+    InternalResponse* stack = __atomic_exchange_n(&worker->submissions, NULL, __ATOMIC_SEQ_CST);
+
+    // Reverse the stack to add handles in submission order
+    InternalResponse* queue = NULL;
+    while (stack != NULL) {
+        InternalResponse* next = stack->nextSubmitted;
+        stack->nextSubmitted = queue;
+        queue = stack;
+        stack = next;
+    }
 
-    struct curl_waitfd readFd = { handleReadFD, CURL_WAIT_POLLIN };
+    while (queue != NULL) {
+        InternalResponse* next = queue->nextSubmitted;
+        queue->added = 1;
+        // Cancelled before it started, completed by cancelTransfers.
+        if (__atomic_load_n(&queue->cancelState, __ATOMIC_SEQ_CST) != naettTransferCancelled) {
+            CURL* handle = acquireHandle(worker);
+            setupHandle(handle, queue);
+            curl_multi_add_handle(worker->multi, handle);
+            queue->handle = handle;
+            queue->addedNS = monotonicNS();
+            startTimers(worker, queue);
+        }
+        queue = next;
+    }
+}
+
+static void removeTransfer(Worker* worker, InternalResponse* res) {
+    curl_multi_remove_handle(worker->multi, res->handle);
+    releaseHandle(worker, res->handle);
+    res->handle = NULL;
+
+    if (res->timed) {
+        if (res->prevTimed) {
+            res->prevTimed->nextTimed = res->nextTimed;
+        } else {
+            worker->timedTransfers = res->nextTimed;
+        }
+        if (res->nextTimed) {
+            res->nextTimed->prevTimed = res->prevTimed;
+        }
+        res->timed = 0;
+    }
+}
 
-    union {
-        CURL* handle;
-        char buf[sizeof(CURL*)];
-    } newHandle;
+// Returns 1 if `timeoutMS` has passed since `start`, otherwise lowers
+// `timeLeft` to the time until it does.
+static int timedOut(int timeoutMS, long long start, long long now, long long* timeLeft) {
+    if (timeoutMS <= 0) {
+        return 0;
+    }
+    long long left = start + timeoutMS - now;
+    if (left <= 0) {
+        return 1;
+    }
+    if (left < *timeLeft) {
+        *timeLeft = left;
+    }
+    return 0;
+}
 
-    int newHandlePos = 0;
+// Fails transfers whose deadline, first byte or idle timeout has passed, adding them
+// to `completed`. Returns the time in milliseconds until the next timeout.
+static int expireTransfers(Worker* worker, InternalResponse** completed) {
+    long long timeLeft = INT_MAX;
+    if (worker->timedTransfers == NULL) {
+        return (int)timeLeft;
+    }
+
+    long long now = monotonicMS();
+    InternalResponse* res = worker->timedTransfers;
+    while (res != NULL) {
+        InternalResponse* next = res->nextTimed;
+        RequestOptions* options = &res->request->options;
+
+        int code = 0;
+        if (timedOut(options->deadlineMS, res->startMS, now, &timeLeft)) {
+            code = naettDeadlineError;
+        } else if (!res->receivedData && timedOut(options->firstByteTimeoutMS, res->startMS, now, &timeLeft)) {
+            code = naettFirstByteTimeoutError;
+        } else if (res->receivedData && timedOut(options->idleTimeoutMS, res->lastReceiveMS, now, &timeLeft)) {
+            code = naettIdleTimeoutError;
+        }
+
+        // When cancelled meanwhile, the transfer is left to cancelTransfers.
+        if (code != 0 && naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing)) {
+            removeTransfer(worker, res);
+            res->code = code;
+            res->nextCompleted = *completed;
+            *completed = res;
+        }
+        res = next;
+    }
+    return (int)timeLeft;
+}
+
+// Stops cancelled transfers and returns their responses, linked through `nextCompleted`.
+// Cancelled responses are only completed here, so that they are not touched after completion.
+static InternalResponse* cancelTransfers(Worker* worker) {
+    InternalResponse* pending = __atomic_exchange_n(&worker->cancellations, NULL, __ATOMIC_SEQ_CST);
+    while (worker->deferredCancellations != NULL) {
+        InternalResponse* deferred = worker->deferredCancellations;
+        worker->deferredCancellations = deferred->nextCancelled;
+        deferred->nextCancelled = pending;
+        pending = deferred;
+    }
+
+    InternalResponse* cancelled = NULL;
+    while (pending != NULL) {
+        InternalResponse* next = pending->nextCancelled;
+        if (!pending->added) {
+            // Still on its way through the submission stack
+            pending->nextCancelled = worker->deferredCancellations;
+            worker->deferredCancellations = pending;
+        } else {
+            if (pending->handle != NULL) {
+                removeTransfer(worker, pending);
+            }
+            pending->code = naettCancelledError;
+            pending->nextCompleted = cancelled;
+            cancelled = pending;
+        }
+        pending = next;
+    }
+    return cancelled;
+}
+
+// Maps the result of a finished transfer to an HTTP status code or a `naettStatus` error.
+static int responseStatus(InternalResponse* res, CURLcode result) {
+    switch (result) {
+        case CURLE_OK: {
+            long responseCode = 0;
+            curl_easy_getinfo(res->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+            return (int)responseCode;
+        }
+        case CURLE_OPERATION_TIMEDOUT: {
+            // Only the connection and low speed timeouts are left to curl.
+            curl_off_t pretransferTime = 0;
+            curl_easy_getinfo(res->handle, CURLINFO_PRETRANSFER_TIME_T, &pretransferTime);
+            return pretransferTime > 0 ? naettLowSpeedError : naettConnectTimeoutError;
+        }
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_PEER_FAILED_VERIFICATION:
+            return naettConnectionError;
+        case CURLE_UNSUPPORTED_PROTOCOL:
+        case CURLE_URL_MALFORMAT:
+        case CURLE_WEIRD_SERVER_REPLY:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+        case CURLE_TOO_MANY_REDIRECTS:
+        case CURLE_GOT_NOTHING:
+            return naettProtocolError;
+        case CURLE_PARTIAL_FILE:
+        case CURLE_WRITE_ERROR:
+        case CURLE_RECV_ERROR:
+            return naettReadError;
+        case CURLE_READ_ERROR:
+        case CURLE_SEND_ERROR:
+            return naettWriteError;
+        default:
+            return naettGenericError;
+    }
+}
+
+static void* curlWorker(void* data) {
+    Worker* worker = (Worker*)data;
+    CURLM* mc = worker->multi;
+    int activeHandles = 0;
+    int messagesLeft = 0;
+
+    while (!__atomic_load_n(&worker->quit, __ATOMIC_SEQ_CST)) {
+        addSubmitted(worker);
+        InternalResponse* completed = cancelTransfers(worker);
 
-    while (1) {
         int status = curl_multi_perform(mc, &activeHandles);
         if (status != CURLM_OK) {
             panic("CURL processing failure");
         }
 
-        struct CURLMsg* message = curl_multi_info_read(mc, &messagesLeft);
-        if (message && message->msg == CURLMSG_DONE) {
-            CURL* handle = message->easy_handle;
+        // Reap every finished transfer before marking the whole batch complete.
+        struct CURLMsg* message = NULL;
+        while ((message = curl_multi_info_read(mc, &messagesLeft)) != NULL) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
             InternalResponse* res = NULL;
-            curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char**)&res);
-            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &res->code);
-            res->complete = 1;
-            curl_easy_cleanup(handle);
-        }
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&res);
+            if (!naettAtomicCAS(&res->cancelState, naettTransferRunning, naettTransferFinishing)) {
+                // Cancelled meanwhile, left to cancelTransfers
+                continue;
+            }
 
+            res->code = responseStatus(res, message->data.result);
+            removeTransfer(worker, res);
 
-        int readyFDs = 0;
-        curl_multi_wait(mc, &readFd, 1, 1, &readyFDs);
-
-        if (readyFDs == 0 && activeHandles == 0 && messagesLeft == 0) {
-            usleep(100 * 1000);
+            res->nextCompleted = completed;
+            completed = res;
         }
 
-        int bytesRead = read(handleReadFD, newHandle.buf, sizeof(newHandle.buf) - newHandlePos);
-        if (bytesRead > 0) {
-            newHandlePos += bytesRead;
+        int nextTimeout = expireTransfers(worker, &completed);
+
+        if (completed != NULL) {
+            naettCompleteResponses(completed);
         }
-        if (newHandlePos == sizeof(newHandle.buf)) {
-            curl_multi_add_handle(mc, newHandle.handle);
-            newHandlePos = 0;
+
+        // Sleep until there is socket activity, a curl timer or one of
+        // our timeouts expires, or a submission wakes us up.
+        status = curl_multi_poll(mc, NULL, 0, nextTimeout, NULL);
+        if (status != CURLM_OK) {
+            panic("CURL processing failure");
         }
     }
 
+    while (worker->pooledHandles > 0) {
+        curl_easy_cleanup(worker->handlePool[--worker->pooledHandles]);
+    }
+
     return NULL;
 }
 
+// Whether HTTP/2 prior knowledge transfers may wait for a connection to multiplex on.
+// libcurl 7.x, at least up to 7.88, fails all but the first of them with CURLE_HTTP2.
+static int pipeWaitPriorKnowledge = 0;
+
 void naettPlatformInit(naettInitData initData) {
     curl_global_init(CURL_GLOBAL_ALL);
-    CURLM* mc = curl_multi_init();
-    int fds[2];
-    if (pipe(fds) != 0) {
-        panic("Failed to open pipe");
+    pipeWaitPriorKnowledge = curl_version_info(CURLVERSION_NOW)->version_num >= 0x080000;
+}
+
+static void stopWorker(Worker* worker) {
+    __atomic_store_n(&worker->quit, 1, __ATOMIC_SEQ_CST);
+    curl_multi_wakeup(worker->multi);
+    pthread_join(worker->thread, NULL);
+}
+
+static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userData) {
+    InternalClient* client = (InternalClient*)userData;
+    pthread_mutex_lock(&client->shareLocks[data]);
+}
+
+static void unlockShare(CURL* handle, curl_lock_data data, void* userData) {
+    InternalClient* client = (InternalClient*)userData;
+    pthread_mutex_unlock(&client->shareLocks[data]);
+}
+
+// Shares DNS resolutions and TLS sessions between all workers of a client.
+// Connections are not shared, libcurl does not support sharing them between
+// concurrently running multi handles. Each worker keeps its own connection cache.
+static int initShare(InternalClient* client) {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&client->shareLocks[i], NULL);
+    }
+
+    client->share = curl_share_init();
+    if (client->share == NULL) {
+        return 0;
+    }
+    curl_share_setopt(client->share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(client->share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(client->share, CURLSHOPT_USERDATA, client);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    return 1;
+}
+
+static void freeShare(InternalClient* client) {
+    if (client->share != NULL) {
+        curl_share_cleanup(client->share);
+        client->share = NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&client->shareLocks[i]);
+    }
+}
+
+// Transfers over the connection limits are queued by libcurl until a
+// connection frees up. All requests to a host go to the same worker, so the
+// per-host limit holds as is, while the total limit is split between workers,
+// of which there are never more than connections allowed.
+static void setupMulti(CURLM* multi, const naettConfig* config, int workerIndex, int numWorkers) {
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (config->maxHostConnections > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)config->maxHostConnections);
+    }
+    if (config->maxConnections > 0) {
+        long maxConnections = config->maxConnections / numWorkers;
+        if (workerIndex < config->maxConnections % numWorkers) {
+            maxConnections++;
+        }
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, maxConnections);
+    }
+    if (config->maxConcurrentStreams > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)config->maxConcurrentStreams);
+    }
+    if (config->connectionCacheSize > 0) {
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)config->connectionCacheSize);
+    }
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    client->completionFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (client->completionFD < 0) {
+        return 0;
+    }
+    if (!initShare(client)) {
+        freeShare(client);
+        close(client->completionFD);
+        return 0;
+    }
+
+    int numWorkers = client->config.workerThreads > 0 ? client->config.workerThreads : 1;
+    if (client->config.maxConnections > 0 && numWorkers > client->config.maxConnections) {
+        numWorkers = client->config.maxConnections;
+    }
+    client->workers = (Worker*)calloc(numWorkers, sizeof(Worker));
+
+    for (int i = 0; i < numWorkers; i++) {
+        Worker* worker = &client->workers[i];
+        worker->multi = curl_multi_init();
+        if (worker->multi != NULL) {
+            setupMulti(worker->multi, &client->config, i, numWorkers);
+        }
+        if (worker->multi == NULL || pthread_create(&worker->thread, NULL, curlWorker, worker) != 0) {
+            if (worker->multi != NULL) {
+                curl_multi_cleanup(worker->multi);
+            }
+            naettPlatformFreeClient(client);
+            return 0;
+        }
+        client->numWorkers++;
+    }
+
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+    for (int i = 0; i < client->numWorkers; i++) {
+        Worker* worker = &client->workers[i];
+        stopWorker(worker);
+        curl_multi_cleanup(worker->multi);
     }
-    handleReadFD = fds[0];
-    handleWriteFD = fds[1];
+    free(client->workers);
+    client->workers = NULL;
+    client->numWorkers = 0;
+    freeShare(client);
+    close(client->completionFD);
+    client->completionFD = -1;
+}
+
+// Hashes the scheme, host and port of the URL, so that all requests to the
+// same host end up on the same worker, where they can reuse connections.
+static unsigned int hashHost(const char* url) {
+    const char* separator = strstr(url, "://");
+    const char* host = separator ? separator + 3 : url;
+    const char* end = host + strcspn(host, "/?#");
+
+    unsigned int hash = 2166136261u;
+    for (const char* c = url; c < end; c++) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*c)) * 16777619u;
+    }
+    return hash;
+}
+
+// Formats the header list once, so that requests can be made repeatedly without
+// rebuilding it.
+static struct curl_slist* buildHeaderList(InternalRequest* req) {
+    struct curl_slist* headerList = NULL;
+    char uaBuf[512];
+    snprintf(uaBuf, sizeof(uaBuf), "User-Agent: %s", req->options.userAgent ? req->options.userAgent : NAETT_UA);
+    headerList = curl_slist_append(headerList, uaBuf);
+
+    KVLink* header = req->options.headers;
+    size_t bufferSize = 0;
+    char* buffer = NULL;
+    while (header) {
+        size_t headerLength = strlen(header->key) + strlen(header->value) + 1 + 1;  // colon + null
+        if (headerLength > bufferSize) {
+            bufferSize = headerLength;
+            buffer = (char*)realloc(buffer, bufferSize);
+        }
+        snprintf(buffer, bufferSize, "%s:%s", header->key, header->value);
+        headerList = curl_slist_append(headerList, buffer);
+        header = header->next;
+    }
+    free(buffer);
+    return headerList;
+}
 
-    int flags = fcntl(handleReadFD, F_GETFL, 0);
-    fcntl(handleReadFD, F_SETFL, flags | O_NONBLOCK);
+// Checks the shape of a URL without allocating: an optional scheme, a host, and no
+// whitespace or control characters. libcurl reports anything else when the request is made.
+static int isValidURL(const char* url) {
+    for (const char* c = url; *c != 0; c++) {
+        if ((unsigned char)*c <= ' ' || *c == 0x7f) {
+            return 0;
+        }
+    }
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create(&workerThread, &attr, curlWorker, mc);
+    const char* host = url;
+    const char* separator = strstr(url, "://");
+    if (separator != NULL) {
+        if (separator == url || !isalpha((unsigned char)url[0])) {
+            return 0;
+        }
+        for (const char* c = url; c < separator; c++) {
+            if (!isalnum((unsigned char)*c) && *c != '+' && *c != '-' && *c != '.') {
+                return 0;
+            }
+        }
+        host = separator + 3;
+    }
+    size_t hostLength = strcspn(host, "/?#");
+    return hostLength > 0 && host[0] != ':';
 }
 
 int naettPlatformInitRequest(InternalRequest* req) {
+    if (!isValidURL(req->url)) {
+        return 0;
+    }
+    req->hostHash = hashHost(req->url);
+    req->headerList = buildHeaderList(req);
+    return req->headerList != NULL;
+}
+
+int naettPlatformSetURL(InternalRequest* req) {
+    if (!isValidURL(req->url)) {
+        return 0;
+    }
+    req->hostHash = hashHost(req->url);
+    return 1;
+}
+
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    if (!isValidURL(req->url)) {
+        return 0;
+    }
+    req->hostHash = hashHost(req->url);
+    req->headerList = source->headerList;
     return 1;
 }
 
 static size_t readCallback(char* buffer, size_t size, size_t numItems, void* userData) {
     InternalResponse* res = (InternalResponse*)userData;
-    InternalRequest* req = res->request;
-    return req->options.bodyReader(buffer, size * numItems, req->options.bodyReaderData);
+    return (size_t)naettReadBody(res->request, res->bodyReaderData, buffer, size * numItems);
+}
+
+static void noteReceived(InternalResponse* res) {
+    if (res->timed) {
+        res->receivedData = 1;
+        res->lastReceiveMS = monotonicMS();
+    }
 }
 
 static size_t writeCallback(char* ptr, size_t size, size_t numItems, void* userData) {
     InternalResponse* res = (InternalResponse*)userData;
-    InternalRequest* req = res->request;
-    size_t bytesWritten = req->options.bodyWriter(ptr, size * numItems, req->options.bodyWriterData);
+    noteReceived(res);
+    size_t bytesWritten = (size_t)naettWriteBody(res->request, res->bodyWriterData, ptr, size * numItems);
     res->totalBytesRead += bytesWritten;
     return bytesWritten;
 }
@@ -138,46 +601,48 @@ static void setupMethod(CURL* curl, const char* method) {
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
 }
 
+static void setupHTTPVersion(CURL* curl, int version) {
+    switch (version) {
+        case naettHTTP1_1:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+            break;
+        case naettHTTP2:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            break;
+        case naettHTTP2PriorKnowledge:
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            break;
+        default:
+            return;
+    }
+
+    // Wait for a connection that can be multiplexed rather than opening new ones.
+    if (version == naettHTTP2 || pipeWaitPriorKnowledge) {
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+}
+
 static size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userData) {
     InternalResponse* res = (InternalResponse*) userData;
     size_t headerSize = size * nitems;
+    noteReceived(res);
 
-    char* headerName = strndup(buffer, headerSize);
-    char* split = strchr(headerName, ':');
-    if (split) {
-        *split = 0;
-        split++;
-        while (*split == ' ') {
-            split++;
-        }
-        char* headerValue = strdup(split);
-
-        char* cr = strchr(headerValue, 13);
-        if (cr) {
-            *cr = 0;
-        }
-
-        char* lf = strchr(headerValue, 10);
-        if (lf) {
-            *lf = 0;
-        }
-
-        naettAlloc(KVLink, node);
-        node->next = res->headers;
-        node->key = headerName;
-        node->value = headerValue;
-        res->headers = node;
+    if (naettParseHeaderLine(res, buffer, headerSize)) {
+        naettHeadersReceived(res);
     }
 
     return headerSize;
 }
 
-void naettPlatformMakeRequest(InternalResponse* res) {
+static void setupHandle(CURL* c, InternalResponse* res) {
     InternalRequest* req = res->request;
 
-    CURL* c = curl_easy_init();
     curl_easy_setopt(c, CURLOPT_URL, req->url);
     curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, req->options.timeoutMS);
+    if (req->options.lowSpeedSeconds > 0) {
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_LIMIT, (long)req->options.lowSpeedBytesPerSecond);
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_TIME, (long)req->options.lowSpeedSeconds);
+    }
 
     curl_easy_setopt(c, CURLOPT_READFUNCTION, readCallback);
     curl_easy_setopt(c, CURLOPT_READDATA, res);
@@ -190,43 +655,114 @@ void naettPlatformMakeRequest(InternalResponse* res) {
 
     curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1);
 
-    int bodySize = res->request->options.bodyReader(NULL, 0, res->request->options.bodyReaderData);
-    curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, bodySize);
+    curl_off_t bodySize = (curl_off_t)naettReadBody(req, res->bodyReaderData, NULL, 0);
+    curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE_LARGE, bodySize);
 
     setupMethod(c, req->options.method);
+    setupHTTPVersion(c, req->options.httpVersion);
 
-    struct curl_slist* headerList = NULL;
-    char uaBuf[512];
-    snprintf(uaBuf, sizeof(uaBuf), "User-Agent: %s", req->options.userAgent ? req->options.userAgent : NAETT_UA);
-    headerList = curl_slist_append(headerList, uaBuf);
+    curl_easy_setopt(c, CURLOPT_HTTPHEADER, req->headerList);
+    curl_easy_setopt(c, CURLOPT_PRIVATE, res);
 
-    KVLink* header = req->options.headers;
-    size_t bufferSize = 0;
-    char* buffer = NULL;
-    while (header) {
-        size_t headerLength = strlen(header->key) + strlen(header->value) + 1 + 1;  // colon + null
-        if (headerLength > bufferSize) {
-            bufferSize = headerLength;
-            buffer = (char*)realloc(buffer, bufferSize);
-        }
-        snprintf(buffer, bufferSize, "%s:%s", header->key, header->value);
-        headerList = curl_slist_append(headerList, buffer);
-        header = header->next;
+    const naettConfig* config = &req->options.client->config;
+    curl_easy_setopt(c, CURLOPT_SHARE, req->options.client->share);
+    if (config->dnsCacheTimeout != 0) {
+        curl_easy_setopt(c, CURLOPT_DNS_CACHE_TIMEOUT, (long)config->dnsCacheTimeout);
     }
-    curl_easy_setopt(c, CURLOPT_HTTPHEADER, headerList);
-    free(buffer);
-    res->headerList = headerList;
+    if (config->maxIdleSeconds > 0) {
+        curl_easy_setopt(c, CURLOPT_MAXAGE_CONN, (long)config->maxIdleSeconds);
+    }
+}
 
-    curl_easy_setopt(c, CURLOPT_PRIVATE, res);
+// Returns the worker that processes requests to the host of a request.
+static Worker* requestWorker(InternalRequest* req) {
+    InternalClient* client = req->options.client;
+    return &client->workers[req->hostHash % client->numWorkers];
+}
+
+void naettPlatformMakeRequest(InternalResponse* res) {
+    submit(requestWorker(res->request), res, res);
+}
+
+typedef struct {
+    Worker* worker;
+    InternalResponse* first;
+    InternalResponse* last;
+} SubmitBatch;
+
+// Splits the requests into one chain per worker, so that each worker gets
+// a single submission and at most one wakeup for the whole batch.
+void naettPlatformMakeRequests(InternalResponse* first) {
+    int numRequests = 0;
+    for (InternalResponse* res = first; res != NULL; res = res->nextQueued) {
+        numRequests++;
+    }
+
+    SubmitBatch* batches = (SubmitBatch*)calloc(numRequests, sizeof(SubmitBatch));
+    int numBatches = 0;
+
+    InternalResponse* res = first;
+    while (res != NULL) {
+        InternalResponse* next = res->nextQueued;
+        Worker* worker = requestWorker(res->request);
+
+        SubmitBatch* batch = batches;
+        while (batch < batches + numBatches && batch->worker != worker) {
+            batch++;
+        }
+        if (batch == batches + numBatches) {
+            batch->worker = worker;
+            batch->last = res;
+            numBatches++;
+        }
+        // Chains are pushed as a stack, so link them newest first.
+        res->nextSubmitted = batch->first;
+        batch->first = res;
+
+        res = next;
+    }
 
-    write(handleWriteFD, &c, sizeof(c));
+    for (int i = 0; i < numBatches; i++) {
+        submit(batches[i].worker, batches[i].first, batches[i].last);
+    }
+    free(batches);
 }
 
 void naettPlatformFreeRequest(InternalRequest* req) {
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+    curl_slist_free_all(req->headerList);
+    req->headerList = NULL;
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return client->completionFD;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+    uint64_t value = 1;
+    ssize_t result = pending ? write(client->completionFD, &value, sizeof(value))
+                             : read(client->completionFD, &value, sizeof(value));
+    // EAGAIN means the descriptor is already drained, or already readable
+    if (result != (ssize_t)sizeof(value) && errno != EAGAIN) {
+        panic("Completion descriptor failure");
+    }
+}
+
 void naettPlatformCloseResponse(InternalResponse* res) {
-    curl_slist_free_all(res->headerList);
+}
+
+void naettPlatformCancelResponse(InternalResponse* res) {
+    Worker* worker = requestWorker(res->request);
+
+    InternalResponse* head = __atomic_load_n(&worker->cancellations, __ATOMIC_RELAXED);
+    do {
+        res->nextCancelled = head;
+    } while (
+        !__atomic_compare_exchange_n(&worker->cancellations, &head, res, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    wakeWorker(worker);
 }
 
 #endif
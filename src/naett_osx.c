@@ -68,15 +68,15 @@ int naettPlatformInitRequest(InternalRequest* req) {
     }
 
     char byteBuffer[10240];
-    int bytesRead = 0;
+    long long bytesRead = 0;
 
-    if (req->options.bodyReader != NULL) {
+    if (req->options.bodyReader != NULL || req->options.bodyReader64 != NULL) {
         id bodyData =
             objc_msgSend_t(id, NSUInteger)(class("NSMutableData"), sel("dataWithCapacity:"), sizeof(byteBuffer));
 
-        int totalBytesRead = 0;
+        long long totalBytesRead = 0;
         do {
-            bytesRead = req->options.bodyReader(byteBuffer, sizeof(byteBuffer), req->options.bodyReaderData);
+            bytesRead = naettReadBody(req, req->options.bodyReaderData, byteBuffer, sizeof(byteBuffer));
             totalBytesRead += bytesRead;
             objc_msgSend_t(void, const void*, NSUInteger)(bodyData, sel("appendBytes:length:"), byteBuffer, bytesRead);
         } while (bytesRead > 0);
@@ -99,7 +99,7 @@ void didReceiveData(id self, SEL _sel, id session, id dataTask, id data) {
 
     object_getInstanceVariable(self, "response", (void**)&res);
 
-    if (res->headers == NULL) {
+    if (res->headers.count == 0) {
         id response = objc_msgSend_t(id)(dataTask, sel("response"));
         res->code = objc_msgSend_t(NSInteger)(response, sel("statusCode"));
         id allHeaders = objc_msgSend_t(id)(response, sel("allHeaderFields"));
@@ -110,27 +110,20 @@ void didReceiveData(id self, SEL _sel, id session, id dataTask, id data) {
 
         objc_msgSend_t(NSInteger, id*, id*, NSUInteger)(
             allHeaders, sel("getObjects:andKeys:count:"), headerValues, headerNames, headerCount);
-        KVLink* firstHeader = NULL;
         for (int i = 0; i < headerCount; i++) {
-            naettAlloc(KVLink, node);
-            node->key = strdup(objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String")));
-            node->value = strdup(objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String")));
-            node->next = firstHeader;
-            firstHeader = node;
+            const char* name = objc_msgSend_t(const char*)(headerNames[i], sel("UTF8String"));
+            const char* value = objc_msgSend_t(const char*)(headerValues[i], sel("UTF8String"));
+            naettAddHeader(res, name, strlen(name), value, strlen(value));
         }
-        res->headers = firstHeader;
 
-        const char* contentLength = naettGetHeader((naettRes*)res, "Content-Length");
-        if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-            res->contentLength = -1;
-        }
+        naettHeadersReceived(res);
     }
 
     const void* bytes = objc_msgSend_t(const void*)(data, sel("bytes"));
     NSUInteger length = objc_msgSend_t(NSUInteger)(data, sel("length"));
 
-    res->request->options.bodyWriter(bytes, length, res->request->options.bodyWriterData);
-    res->totalBytesRead += (int)length;
+    naettWriteBody(res->request, res->bodyWriterData, bytes, length);
+    res->totalBytesRead += length;
 
     release(p);
 }
@@ -139,10 +132,12 @@ static void didComplete(id self, SEL _sel, id session, id dataTask, id error) {
     InternalResponse* res = NULL;
     object_getInstanceVariable(self, "response", (void**)&res);
     if (res != NULL) {
-        if (error != nil) {
+        if (res->cancelState == naettTransferCancelled) {
+            res->code = naettCancelledError;
+        } else if (error != nil) {
             res->code = naettConnectionError;
         }
-        res->complete = 1;
+        naettCompleteResponse(res);
     }
 }
 
@@ -164,6 +159,25 @@ static id createDelegate(void) {
     return delegate;
 }
 
+int naettPlatformSetURL(InternalRequest* req) {
+    id p = pool();
+
+    id urlString = NSString(req->url);
+    id url = objc_msgSend_t(id, id)(class("NSURL"), sel("URLWithString:"), urlString);
+    if (url != nil) {
+        objc_msgSend_t(void, id)(req->urlRequest, sel("setURL:"), url);
+    }
+
+    release(p);
+    return url != nil;
+}
+
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // The copy keeps the method, headers and body, and gets its own URL.
+    req->urlRequest = objc_msgSend_id(source->urlRequest, sel("mutableCopy"));
+    return naettPlatformSetURL(req);
+}
+
 void naettPlatformMakeRequest(InternalResponse* res) {
     InternalRequest* req = res->request;
     id p = pool();
@@ -192,9 +206,38 @@ void naettPlatformFreeRequest(InternalRequest* req) {
     req->urlRequest = nil;
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
 void naettPlatformCloseResponse(InternalResponse* res) {
     objc_msgSend_void(res->session, sel("invalidateAndCancel"));
     res->session = nil;
 }
 
+void naettPlatformCancelResponse(InternalResponse* res) {
+    objc_msgSend_void(res->session, sel("invalidateAndCancel"));
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
+}
+
 #endif  // __APPLE__
@@ -66,32 +66,28 @@ static LPCWSTR packHeaders(InternalRequest* req) {
 
 static void unpackHeaders(InternalResponse* res, LPWSTR packed) {
     size_t len = 0;
-    KVLink* firstHeader = NULL;
     while ((len = wcslen(packed)) != 0) {
         char* header = winToUTF8(packed);
-        char* split = strchr(header, ':');
-        if (split) {
-            *split = 0;
-            split++;
-            while (*split == ' ') {
-                split++;
-            }
-            naettAlloc(KVLink, node);
-            node->key = strdup(header);
-            node->value = strdup(split);
-            node->next = firstHeader;
-            firstHeader = node;
-        }
+        naettParseHeaderLine(res, header, strlen(header));
         free(header);
         packed += len + 1;
     }
-    res->headers = firstHeader;
 }
 
 static void CALLBACK
 callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInformation, DWORD statusInfoLength) {
     InternalResponse* res = (InternalResponse*)context;
 
+    // Cancelling closes the request handle, failing the pending step of the request,
+    // which is then not continued.
+    if (res != NULL && res->cancelState == naettTransferCancelled) {
+        if (!naettAtomicLoad(&res->complete)) {
+            res->code = naettCancelledError;
+            naettCompleteResponse(res);
+        }
+        return;
+    }
+
     switch (status) {
         case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE: {
             DWORD bufSize = 0;
@@ -111,10 +107,7 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
             unpackHeaders(res, buffer);
             free(buffer);
 
-            const char* contentLength = naettGetHeader((naettRes*)res, "Content-Length");
-            if (!contentLength || sscanf(contentLength, "%d", &res->contentLength) != 1) {
-                res->contentLength = -1;
-            }
+            naettHeadersReceived(res);
 
             DWORD statusCode = 0;
             DWORD statusCodeSize = sizeof(statusCode);
@@ -129,7 +122,7 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
 
             if (!WinHttpQueryDataAvailable(request, NULL)) {
                 res->code = naettProtocolError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
         } break;
 
@@ -137,51 +130,50 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
             DWORD* available = (DWORD*)statusInformation;
             res->bytesLeft = *available;
             if (res->bytesLeft == 0) {
-                res->complete = 1;
+                naettCompleteResponse(res);
                 break;
             }
 
             size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
             if (!WinHttpReadData(request, res->buffer, (DWORD)bytesToRead, NULL)) {
                 res->code = naettReadError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
         } break;
 
         case WINHTTP_CALLBACK_STATUS_READ_COMPLETE: {
             size_t bytesRead = statusInfoLength;
 
-            InternalRequest* req = res->request;
-            if (req->options.bodyWriter(res->buffer, (int)bytesRead, req->options.bodyWriterData) != bytesRead) {
+            if (naettWriteBody(res->request, res->bodyWriterData, res->buffer, bytesRead) != (long long)bytesRead) {
                 res->code = naettReadError;
-                res->complete = 1;
+                naettCompleteResponse(res);
             }
-            res->totalBytesRead += (int)bytesRead;
+            res->totalBytesRead += bytesRead;
             res->bytesLeft -= bytesRead;
             if (res->bytesLeft > 0) {
                 size_t bytesToRead = min(res->bytesLeft, sizeof(res->buffer));
                 if (!WinHttpReadData(request, res->buffer, (DWORD)bytesToRead, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             } else {
                 if (!WinHttpQueryDataAvailable(request, NULL)) {
                     res->code = naettProtocolError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             }
         } break;
 
         case WINHTTP_CALLBACK_STATUS_WRITE_COMPLETE:
         case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE: {
-            int bytesRead = res->request->options.bodyReader(
-                res->buffer, sizeof(res->buffer), res->request->options.bodyReaderData);
+            long long bytesRead =
+                naettReadBody(res->request, res->bodyReaderData, res->buffer, sizeof(res->buffer));
             if (bytesRead) {
-                WinHttpWriteData(request, res->buffer, bytesRead, NULL);
+                WinHttpWriteData(request, res->buffer, (DWORD)bytesRead, NULL);
             } else {
                 if (!WinHttpReceiveResponse(request, NULL)) {
                     res->code = naettReadError;
-                    res->complete = 1;
+                    naettCompleteResponse(res);
                 }
             }
         } break;
@@ -205,12 +197,14 @@ callback(HINTERNET request, DWORD_PTR context, DWORD status, LPVOID statusInform
                     res->code = naettGenericError;
             }
 
-            res->complete = 1;
+            naettCompleteResponse(res);
         } break;
     }
 }
 
-int naettPlatformInitRequest(InternalRequest* req) {
+// Connects the session of a request to the host of its URL. On failure,
+// the previous connection is kept.
+static int connectURL(InternalRequest* req) {
     LPWSTR url = winFromUTF8(req->url);
 
     URL_COMPONENTS components;
@@ -227,10 +221,31 @@ int naettPlatformInitRequest(InternalRequest* req) {
         return 0;
     }
 
-    req->host = wcsndup(components.lpszHostName, components.dwHostNameLength);
-    req->resource = wcsndup(components.lpszUrlPath, components.dwUrlPathLength + components.dwExtraInfoLength);
+    LPWSTR host = wcsndup(components.lpszHostName, components.dwHostNameLength);
+    LPWSTR resource = wcsndup(components.lpszUrlPath, components.dwUrlPathLength + components.dwExtraInfoLength);
     free(url);
 
+    HINTERNET connection = WinHttpConnect(req->session, host, components.nPort, 0);
+    if (!connection) {
+        free(host);
+        free(resource);
+        return 0;
+    }
+
+    if (req->connection != NULL) {
+        WinHttpCloseHandle(req->connection);
+    }
+    free(req->host);
+    free(req->resource);
+
+    req->connection = connection;
+    req->host = host;
+    req->resource = resource;
+    req->openFlags = components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0;
+    return 1;
+}
+
+int naettPlatformInitRequest(InternalRequest* req) {
     LPWSTR uaBuf = winFromUTF8(req->options.userAgent ? req->options.userAgent : NAETT_UA);
     req->session = WinHttpOpen(uaBuf,
         WINHTTP_ACCESS_TYPE_NO_PROXY,
@@ -248,65 +263,74 @@ int naettPlatformInitRequest(InternalRequest* req) {
     // Set the connect timeout. Leave the other three timeouts at their default values.
     WinHttpSetTimeouts(req->session, 0, req->options.timeoutMS, 30000, 30000);
 
-    req->connection = WinHttpConnect(req->session, req->host, components.nPort, 0);
-    if (!req->connection) {
+    if (!connectURL(req)) {
         naettPlatformFreeRequest(req);
         return 0;
     }
 
-    LPWSTR verb = winFromUTF8(req->options.method);
-    req->request = WinHttpOpenRequest(req->connection,
-        verb,
+    // Request handles are opened per response, so that a request can be made
+    // many times concurrently.
+    req->verb = winFromUTF8(req->options.method);
+    req->headers = (LPWSTR)packHeaders(req);
+
+    return 1;
+}
+
+int naettPlatformSetURL(InternalRequest* req) {
+    return connectURL(req);
+}
+
+int naettPlatformCloneRequest(InternalRequest* req, const InternalRequest* source) {
+    // The session carries per request callbacks and timeouts, so a clone opens its own.
+    return naettPlatformInitRequest(req);
+}
+
+void naettPlatformMakeRequest(InternalResponse* res) {
+    InternalRequest* req = res->request;
+
+    res->handle = WinHttpOpenRequest(req->connection,
+        req->verb,
         req->resource,
         NULL,
         WINHTTP_NO_REFERER,
         WINHTTP_DEFAULT_ACCEPT_TYPES,
-        components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
-    free(verb);
-    if (!req->request) {
-        naettPlatformFreeRequest(req);
-        return 0;
+        req->openFlags);
+    if (!res->handle) {
+        res->code = naettConnectionError;
+        naettCompleteResponse(res);
+        return;
     }
 
-    LPCWSTR headers = packHeaders(req);
-    if (headers[0] != 0) {
+    if (req->headers[0] != 0) {
         if (!WinHttpAddRequestHeaders(
-                req->request, headers, -1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE)) {
-            naettPlatformFreeRequest(req);
-            free((LPWSTR)headers);
-            return 0;
+                res->handle, req->headers, -1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE)) {
+            res->code = naettGenericError;
+            naettCompleteResponse(res);
+            return;
         }
     }
-    free((LPWSTR)headers);
-
-    return 1;
-}
-
-void naettPlatformMakeRequest(InternalResponse* res) {
-    InternalRequest* req = res->request;
 
     LPCWSTR extraHeaders = WINHTTP_NO_ADDITIONAL_HEADERS;
     WCHAR contentLengthHeader[64];
 
-    int contentLength = req->options.bodyReader(NULL, 0, req->options.bodyReaderData);
+    long long contentLength = naettReadBody(req, res->bodyReaderData, NULL, 0);
     if (contentLength > 0) {
-        swprintf(contentLengthHeader, 64, L"Content-Length: %d", contentLength);
+        swprintf(contentLengthHeader, 64, L"Content-Length: %lld", contentLength);
         extraHeaders = contentLengthHeader;
     }
 
-    if (!WinHttpSendRequest(req->request, extraHeaders, -1, NULL, 0, 0, (DWORD_PTR)res)) {
+    if (!WinHttpSendRequest(res->handle, extraHeaders, -1, NULL, 0, 0, (DWORD_PTR)res)) {
         res->code = naettConnectionError;
-        res->complete = 1;
+        naettCompleteResponse(res);
     }
 }
 
+void naettPlatformFreeSharedRequest(InternalRequest* req) {
+}
+
 void naettPlatformFreeRequest(InternalRequest* req) {
     assert(req != NULL);
 
-    if (req->request != NULL) {
-        WinHttpCloseHandle(req->request);
-        req->request = NULL;
-    }
     if (req->connection != NULL) {
         WinHttpCloseHandle(req->connection);
         req->connection = NULL;
@@ -323,9 +347,53 @@ void naettPlatformFreeRequest(InternalRequest* req) {
         free(req->resource);
         req->resource = NULL;
     }
+    if (req->verb != NULL) {
+        free(req->verb);
+        req->verb = NULL;
+    }
+    if (req->headers != NULL) {
+        free(req->headers);
+        req->headers = NULL;
+    }
+}
+
+// Closes the request handle of a response, if not already closed.
+static void closeHandle(InternalResponse* res) {
+    HINTERNET handle = (HINTERNET)InterlockedExchangePointer((PVOID volatile*)&res->handle, NULL);
+    if (handle != NULL) {
+        WinHttpCloseHandle(handle);
+    }
 }
 
 void naettPlatformCloseResponse(InternalResponse* res) {
+    closeHandle(res);
+}
+
+void naettPlatformCancelResponse(InternalResponse* res) {
+    // Aborts the pending operation right away. Its error callback then completes the response.
+    closeHandle(res);
+}
+
+int naettPlatformInitClient(InternalClient* client) {
+    return 1;
+}
+
+void naettPlatformFreeClient(InternalClient* client) {
+}
+
+void naettPlatformMakeRequests(InternalResponse* first) {
+    while (first != NULL) {
+        InternalResponse* next = first->nextQueued;
+        naettPlatformMakeRequest(first);
+        first = next;
+    }
+}
+
+int naettPlatformCompletionFD(InternalClient* client) {
+    return -1;
+}
+
+void naettPlatformSignalCompletion(InternalClient* client, int pending) {
 }
 
 #endif  // __WINDOWS__
@@ -1,3 +1,3 @@
 module testrig
 
-go 1.17
+go 1.24
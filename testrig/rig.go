@@ -1,13 +1,18 @@
 package main
 
 import (
+	"bytes"
 	"fmt"
 	"io"
 	"log"
+	"net"
 	"net/http"
 	"os"
 	"os/exec"
 	"path"
+	"strconv"
+	"sync/atomic"
+	"time"
 )
 
 func main() {
@@ -44,7 +49,8 @@ func runTest() error {
 	if err != nil {
 		return err
 	}
-	cmd := exec.Command(path.Join(cwd, "test"), "http://localhost:4711")
+	args := []string{"http://localhost:4711", "http://localhost:4712"}
+	cmd := exec.Command(path.Join(cwd, "test"), args...)
 	output, err := cmd.CombinedOutput()
 	if err != nil {
 		return fmt.Errorf("Failed to run test: %s", string(output))
@@ -68,9 +74,47 @@ func serve() {
 	http.HandleFunc("/post", trace(testPOSTHandler))
 	http.HandleFunc("/redirect", trace(testRedirectHandler))
 	http.HandleFunc("/redirected", trace(redirectedHandler))
+	http.HandleFunc("/slow", trace(slowHandler))
+	http.HandleFunc("/trickle", trace(trickleHandler))
+	http.HandleFunc("/crawl", trace(crawlHandler))
+	http.HandleFunc("/useragent", trace(userAgentHandler))
+	http.HandleFunc("/headers", headersHandler)
+	http.HandleFunc("/folded", foldedHandler)
+	http.HandleFunc("/large", largeHandler)
+	http.HandleFunc("/zeros", zerosHandler)
+	http.HandleFunc("/count", countHandler)
+	go serveH2C(":4712", http.DefaultServeMux)
 	log.Fatal(http.ListenAndServe(":4711", nil))
 }
 
+// serveH2C serves handler over both HTTP/1.1 and cleartext HTTP/2 with prior
+// knowledge, and reports the number of accepted connections on /connections.
+func serveH2C(addr string, handler http.Handler) {
+	var connections int64
+
+	mux := http.NewServeMux()
+	mux.Handle("/", handler)
+	mux.HandleFunc("/connections", func(w http.ResponseWriter, _ *http.Request) {
+		fmt.Fprintf(w, "%d", atomic.LoadInt64(&connections))
+	})
+
+	protocols := new(http.Protocols)
+	protocols.SetHTTP1(true)
+	protocols.SetUnencryptedHTTP2(true)
+
+	server := &http.Server{
+		Addr:      addr,
+		Handler:   mux,
+		Protocols: protocols,
+		ConnState: func(_ net.Conn, state http.ConnState) {
+			if state == http.StateNew {
+				atomic.AddInt64(&connections, 1)
+			}
+		},
+	}
+	log.Fatal(server.ListenAndServe())
+}
+
 func fail(w http.ResponseWriter, message string) {
 	w.WriteHeader(400)
 	w.Write([]byte(message + "\n"))
@@ -153,3 +197,100 @@ func testRedirectHandler(w http.ResponseWriter, _ *http.Request) {
 func redirectedHandler(w http.ResponseWriter, _ *http.Request) {
 	w.Write([]byte("Redirected"))
 }
+
+func slowHandler(w http.ResponseWriter, _ *http.Request) {
+	time.Sleep(500 * time.Millisecond)
+	ok(w)
+}
+
+// Sends the headers and part of the body right away, then stalls.
+func trickleHandler(w http.ResponseWriter, _ *http.Request) {
+	w.Write([]byte("O"))
+	w.(http.Flusher).Flush()
+	time.Sleep(500 * time.Millisecond)
+	w.Write([]byte("K"))
+}
+
+// Sends the body a byte per second, for ten seconds.
+func crawlHandler(w http.ResponseWriter, _ *http.Request) {
+	for i := 0; i < 10; i++ {
+		if _, err := w.Write([]byte(".")); err != nil {
+			return
+		}
+		w.(http.Flusher).Flush()
+		time.Sleep(time.Second)
+	}
+}
+
+// Responds with a typical number of headers, X-Header-0 to X-Header-23 with values value-0 to value-23.
+func headersHandler(w http.ResponseWriter, _ *http.Request) {
+	for i := 0; i < 24; i++ {
+		w.Header().Set(fmt.Sprintf("X-Header-%d", i), fmt.Sprintf("value-%d", i))
+	}
+	ok(w)
+}
+
+// Writes a raw response with folded, duplicate and padded headers, which net/http does not produce.
+func foldedHandler(w http.ResponseWriter, _ *http.Request) {
+	conn, buf, err := w.(http.Hijacker).Hijack()
+	if err != nil {
+		fail(w, err.Error())
+		return
+	}
+	defer conn.Close()
+	buf.WriteString("HTTP/1.1 200 OK\r\n" +
+		"X-Folded: first\r\n" +
+		"  second\r\n" +
+		"\tthird\r\n" +
+		"X-Duplicate: one\r\n" +
+		"X-Duplicate: two\r\n" +
+		"X-Padded: \t padded \t\r\n" +
+		"X-Empty:\r\n" +
+		"Content-Length: 2\r\n" +
+		"Connection: close\r\n" +
+		"\r\n" +
+		"OK")
+	buf.Flush()
+}
+
+var largeBody = bytes.Repeat([]byte("0123456789"), 100000)
+
+// Responds with a 1 MB body and its Content-Length.
+func largeHandler(w http.ResponseWriter, _ *http.Request) {
+	w.Header().Set("Content-Length", strconv.Itoa(len(largeBody)))
+	w.Write(largeBody)
+}
+
+// Streams the number of zero bytes given by the size query parameter.
+func zerosHandler(w http.ResponseWriter, r *http.Request) {
+	size, err := strconv.ParseInt(r.URL.Query().Get("size"), 10, 64)
+	if err != nil {
+		fail(w, err.Error())
+		return
+	}
+	w.Header().Set("Content-Length", strconv.FormatInt(size, 10))
+	io.CopyN(w, zeroReader{}, size)
+}
+
+type zeroReader struct{}
+
+func (zeroReader) Read(p []byte) (int, error) {
+	for i := range p {
+		p[i] = 0
+	}
+	return len(p), nil
+}
+
+// Responds with the number of request body bytes received, and their declared length.
+func countHandler(w http.ResponseWriter, r *http.Request) {
+	count, err := io.Copy(io.Discard, r.Body)
+	if err != nil {
+		fail(w, err.Error())
+		return
+	}
+	w.Write([]byte(fmt.Sprintf("%d/%d", count, r.ContentLength)))
+}
+
+func userAgentHandler(w http.ResponseWriter, r *http.Request) {
+	w.Write([]byte(r.UserAgent()))
+}
@@ -1,8 +1,24 @@
 #include "../naett.h"
+// For benchmarking the header parser directly
+#include "../src/naett_internal.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if __linux__ && !__ANDROID__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#endif
 
 #if __ANDROID__
 #include <android/log.h>
@@ -11,6 +27,37 @@
 #define LOG(...) printf(__VA_ARGS__)
 #endif  // __ANDROID__
 
+#if __linux__ && !__ANDROID__ && defined(__GLIBC__)
+// Count heap allocations made by the whole process, including libcurl,
+// by interposing the glibc allocator entry points.
+#define COUNT_ALLOCATIONS 1
+
+static unsigned long allocationCount = 0;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static unsigned long allocations(void) {
+    return __atomic_load_n(&allocationCount, __ATOMIC_RELAXED);
+}
+#endif
+
 int fail(const char* where, const char* message) {
     LOG("%s: FAIL - %s\n", where, message);
     return 0;
@@ -20,6 +67,20 @@ void trace(const char* where, const char* message) {
     LOG("%s: %s\n", where, message);
 }
 
+double nowMS(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+#endif
+}
+
 int verifyBody(naettRes* res, const char* expected) {
     int bodyLength = 0;
     const char* body = naettGetBody(res, &bodyLength);
@@ -44,6 +105,13 @@ int verifyBody(naettRes* res, const char* expected) {
         return fail(__func__, "");
     }
 
+    int totalSize = 0;
+    int bytesRead = naettGetTotalBytesRead(res, &totalSize);
+    if (bytesRead != bodyLength || totalSize != expectedLength) {
+        LOG("Expected %d of %d bytes read, got %d of %d.", bodyLength, expectedLength, bytesRead, totalSize);
+        return fail(__func__, "");
+    }
+
     return 1;
 }
 
@@ -63,8 +131,8 @@ int runGETTest(const char* endpoint) {
         return fail(__func__, "Failed to make request");
     }
 
-    while (!naettComplete(res)) {
-        usleep(100 * 1000);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
     }
 
     int status = naettGetStatus(res);
@@ -106,8 +174,8 @@ int runPOSTTest(const char* endpoint) {
         return fail(__func__, "Failed to make request");
     }
 
-    while (!naettComplete(res)) {
-        usleep(100 * 1000);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
     }
 
     if (naettGetStatus(res) < 0) {
@@ -130,6 +198,107 @@ int runPOSTTest(const char* endpoint) {
     return 1;
 }
 
+int runConcurrentMakeTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/post", endpoint);
+
+    naettReq* req = naettRequest(
+        testURL, naettMethod("POST"), naettHeader("accept", "naett/testresult"), naettBody("TestRequest!", 12));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    const int numResponses = 8;
+    naettRes* responses[numResponses];
+    for (int i = 0; i < numResponses; i++) {
+        responses[i] = naettMake(req);
+        if (responses[i] == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+    }
+
+    for (int i = 0; i < numResponses; i++) {
+        if (!naettWait(responses[i], 10000)) {
+            return fail(__func__, "Timed out waiting for response");
+        }
+        if (naettGetStatus(responses[i]) != 200 || !verifyBody(responses[i], "OK")) {
+            return fail(__func__, "Expected each response to send the full body");
+        }
+        naettClose(responses[i]);
+    }
+    naettFree(req);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+static int makeAndVerify(naettReq* req, const char* expectedBody) {
+    naettRes* res = naettMake(req);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    int ok = naettGetStatus(res) == 200 && verifyBody(res, expectedBody);
+    naettClose(res);
+    return ok;
+}
+
+int runCloneTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/get?page=1", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    if (!makeAndVerify(req, "OK")) {
+        return fail(__func__, "Original request failed");
+    }
+
+    snprintf(testURL, sizeof(testURL), "%s/get?page=2", endpoint);
+    if (!naettSetURL(req, testURL)) {
+        return fail(__func__, "Failed to set URL");
+    }
+    if (!makeAndVerify(req, "OK")) {
+        return fail(__func__, "Expected retargeted request to keep its options");
+    }
+    if (naettSetURL(req, "::not a url::")) {
+        return fail(__func__, "Expected invalid URL to be rejected");
+    }
+    if (!makeAndVerify(req, "OK")) {
+        return fail(__func__, "Expected rejected URL to leave the request unchanged");
+    }
+    naettFree(req);
+
+    snprintf(testURL, sizeof(testURL), "%s/post", endpoint);
+    req = naettRequest(
+        testURL, naettMethod("POST"), naettHeader("accept", "naett/testresult"), naettBody("TestRequest!", 12));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    if (naettReqClone(req, "::not a url::") != NULL) {
+        return fail(__func__, "Expected clone with invalid URL to fail");
+    }
+    snprintf(testURL, sizeof(testURL), "%s/post?page=2", endpoint);
+    naettReq* clone = naettReqClone(req, testURL);
+    naettFree(req);
+    if (clone == NULL) {
+        return fail(__func__, "Failed to clone request");
+    }
+    if (!makeAndVerify(clone, "OK")) {
+        return fail(__func__, "Expected clone to keep the method, headers and body");
+    }
+    naettFree(clone);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
 int runRedirectTest(const char* endpoint) {
     trace(__func__, "begin");
 
@@ -149,8 +318,8 @@ int runRedirectTest(const char* endpoint) {
     }
 
     trace(__func__, "Waiting for completion");
-    while (!naettComplete(res)) {
-        usleep(100 * 1000);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
     }
 
     if (naettGetStatus(res) < 0) {
@@ -166,6 +335,10 @@ int runRedirectTest(const char* endpoint) {
         return fail(__func__, "Expected 200");
     }
 
+    if (naettGetHeader(res, "Location") != NULL) {
+        return fail(__func__, "Expected only the headers of the final response");
+    }
+
     naettClose(res);
     naettFree(req);
 
@@ -174,44 +347,157 @@ int runRedirectTest(const char* endpoint) {
     return 1;
 }
 
-int runStressTest(const char* endpoint) {
+static int countHeader(const char* name, const char* value, void* userData) {
+    (*(int*)userData)++;
+    return 1;
+}
+
+int runHeaderTest(const char* endpoint) {
     trace(__func__, "begin");
 
     char testURL[512];
-    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+    snprintf(testURL, sizeof(testURL), "%s/headers", endpoint);
 
-    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+    naettReq* req = naettRequest(testURL, naettMethod("GET"));
     if (req == NULL) {
         return fail(__func__, "Failed to create request");
     }
+    naettRes* res = naettMake(req);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    if (naettGetStatus(res) != 200) {
+        return fail(__func__, "Expected 200");
+    }
 
-    for (int i = 0; i < 8000; i++) {
-        naettRes* res = naettMake(req);
-        if (res == NULL) {
-            return fail(__func__, "Failed to make request");
+    for (int i = 0; i < 24; i++) {
+        char name[32];
+        char expected[32];
+        snprintf(name, sizeof(name), i % 2 ? "x-header-%d" : "X-HEADER-%d", i);
+        snprintf(expected, sizeof(expected), "value-%d", i);
+        const char* value = naettGetHeader(res, name);
+        if (value == NULL || strcmp(value, expected) != 0) {
+            return fail(__func__, "Unexpected header value");
         }
+    }
 
-        while (!naettComplete(res)) {
-            usleep(1 * 1000);
-        }
+    const char* names = "Content-LengthX-Header-7";
+    const char* length = naettGetHeaderN(res, names, 14);
+    if (length == NULL || strcmp(length, "2") != 0) {
+        return fail(__func__, "Expected Content-Length of 2");
+    }
+    const char* value = naettGetHeaderN(res, names + 14, 10);
+    if (value == NULL || strcmp(value, "value-7") != 0) {
+        return fail(__func__, "Expected X-Header-7 to be found");
+    }
+    if (naettGetHeaderN(res, names, 7) != NULL || naettGetHeader(res, "X-Header-24") != NULL) {
+        return fail(__func__, "Expected missing headers not to be found");
+    }
 
-        int status = naettGetStatus(res);
+    int count = 0;
+    naettListHeaders(res, countHeader, &count);
+    if (count < 24) {
+        return fail(__func__, "Expected all headers to be listed");
+    }
 
-        if (status < 0) {
-            return fail(__func__, "Connection failed");
-        }
+    naettClose(res);
+    naettFree(req);
 
-        if (!verifyBody(res, "OK")) {
-            return 0;
+#if __linux__ && !__ANDROID__
+    snprintf(testURL, sizeof(testURL), "%s/folded", endpoint);
+    req = naettRequest(testURL, naettMethod("GET"));
+    res = naettMake(req);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    if (naettGetStatus(res) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+    struct {
+        const char* name;
+        const char* value;
+    } expected[] = {
+        { "X-Folded", "first second third" },
+        { "X-Duplicate", "two" },
+        { "X-Padded", "padded" },
+        { "X-Empty", "" },
+    };
+    for (int i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        const char* value = naettGetHeader(res, expected[i].name);
+        if (value == NULL || strcmp(value, expected[i].value) != 0) {
+            LOG("Expected %s to be [%s], got [%s]\n", expected[i].name, expected[i].value, value ? value : "(null)");
+            return fail(__func__, "Unexpected header value");
         }
+    }
+    naettClose(res);
+    naettFree(req);
+#endif
 
-        if (naettGetStatus(res) != 200) {
-            return fail(__func__, "Expected 200");
-        }
+    trace(__func__, "end");
 
-        naettClose(res);
+    return 1;
+}
+
+#if __linux__ && !__ANDROID__
+static long long readZeros(void* dest, long long bufferSize, void* userData) {
+    long long* left = (long long*)userData;
+    if (dest == NULL) {
+        return *left;
+    }
+    long long bytes = bufferSize < *left ? bufferSize : *left;
+    memset(dest, 0, (size_t)bytes);
+    *left -= bytes;
+    return bytes;
+}
+
+static long long countBytes(const void* source, long long bytes, void* userData) {
+    *(long long*)userData += bytes;
+    return bytes;
+}
+
+int runLargeBodyTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    // Just over 2 GiB each way, streamed without buffering
+    const long long size = 2147483648LL + 1000;
+    char testURL[512];
+    char expected[64];
+
+    snprintf(testURL, sizeof(testURL), "%s/count", endpoint);
+    long long left = size;
+    naettReq* req = naettRequest(testURL, naettMethod("POST"), naettBodyReader64(readZeros, &left));
+    naettRes* res = naettMake(req);
+    if (!naettWait(res, 120000)) {
+        return fail(__func__, "Timed out uploading");
     }
+    snprintf(expected, sizeof(expected), "%lld/%lld", size, size);
+    if (naettGetStatus(res) != 200 || !verifyBody(res, expected)) {
+        return fail(__func__, "Expected the whole body to be uploaded");
+    }
+    naettClose(res);
+    naettFree(req);
 
+    snprintf(testURL, sizeof(testURL), "%s/zeros?size=%lld", endpoint, size);
+    long long received = 0;
+    req = naettRequest(testURL, naettMethod("GET"), naettBodyWriter64(countBytes, &received));
+    res = naettMake(req);
+    if (!naettWait(res, 120000)) {
+        return fail(__func__, "Timed out downloading");
+    }
+    if (naettGetStatus(res) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+    long long totalSize = 0;
+    long long bytesRead = naettGetTotalBytesRead64(res, &totalSize);
+    if (received != size || bytesRead != size || totalSize != size) {
+        LOG("Expected %lld bytes, got %lld written and %lld of %lld read\n", size, received, bytesRead, totalSize);
+        return fail(__func__, "Expected the whole body to be downloaded");
+    }
+    int totalSize32 = 0;
+    if (naettGetTotalBytesRead(res, &totalSize32) != 2147483647 || totalSize32 != 2147483647) {
+        return fail(__func__, "Expected 32-bit sizes to saturate");
+    }
+    naettClose(res);
     naettFree(req);
 
     trace(__func__, "end");
@@ -219,34 +505,1495 @@ int runStressTest(const char* endpoint) {
     return 1;
 }
 
-int runTests(const char* endpoint) {
-    if (!runGETTest(endpoint)) {
-        return 0;
+#endif
+
+int runWaitTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char slowURL[512];
+    snprintf(slowURL, sizeof(slowURL), "%s/slow", endpoint);
+    char fastURL[512];
+    snprintf(fastURL, sizeof(fastURL), "%s/get", endpoint);
+
+    naettReq* slowReq = naettRequest(slowURL, naettMethod("GET"));
+    naettReq* fastReq = naettRequest(fastURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+    if (slowReq == NULL || fastReq == NULL) {
+        return fail(__func__, "Failed to create request");
     }
-    if (!runPOSTTest(endpoint)) {
-        return 0;
+
+    naettRes* slowRes = naettMake(slowReq);
+    if (slowRes == NULL) {
+        return fail(__func__, "Failed to make request");
     }
-    if (!runRedirectTest(endpoint)) {
+
+    if (naettWait(slowRes, 50)) {
+        return fail(__func__, "Expected wait to time out");
+    }
+    if (naettComplete(slowRes)) {
+        return fail(__func__, "Expected response to be pending");
+    }
+
+    naettRes* fastRes = naettMake(fastReq);
+    if (fastRes == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+
+    naettRes* responses[] = { slowRes, fastRes };
+    int index = -1;
+    if (!naettWaitAny(responses, 2, 10000, &index)) {
+        return fail(__func__, "Timed out waiting for any response");
+    }
+    if (index != 1) {
+        return fail(__func__, "Expected the fast response to complete first");
+    }
+    if (!verifyBody(fastRes, "OK")) {
         return 0;
     }
-    if (!runStressTest(endpoint)) {
+
+    if (!naettWait(slowRes, -1)) {
+        return fail(__func__, "Expected response to complete");
+    }
+    if (naettGetStatus(slowRes) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+
+    naettClose(slowRes);
+    naettClose(fastRes);
+    naettFree(slowReq);
+    naettFree(fastReq);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+typedef struct {
+    volatile int calls;
+    int status;
+    int completeInCallback;
+} CallbackResult;
+
+static void recordCompletion(naettRes* res, int status, void* userData) {
+    CallbackResult* result = (CallbackResult*)userData;
+    result->status = status;
+    result->completeInCallback = naettComplete(res);
+    result->calls++;
+}
+
+static void closeOnCompletion(naettRes* res, int status, void* userData) {
+    CallbackResult* result = (CallbackResult*)userData;
+    result->status = status;
+    naettClose(res);
+    result->calls++;
+}
+
+int runCompletionCallbackTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/get", endpoint);
+
+    CallbackResult result = { 0 };
+    naettReq* req = naettRequest(testURL,
+        naettMethod("GET"),
+        naettHeader("accept", "naett/testresult"),
+        naettOnComplete(recordCompletion, &result));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    naettRes* res = naettMake(req);
+    if (res == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    if (result.calls != 1) {
+        return fail(__func__, "Expected exactly one callback before completion");
+    }
+    if (result.completeInCallback) {
+        return fail(__func__, "Expected callback to run before completion");
+    }
+    if (result.status != 200 || naettGetStatus(res) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+    if (!verifyBody(res, "OK")) {
         return 0;
     }
+    naettClose(res);
+    naettFree(req);
+
+    CallbackResult closeResult = { 0 };
+    req = naettRequest(testURL,
+        naettMethod("GET"),
+        naettHeader("accept", "naett/testresult"),
+        naettOnComplete(closeOnCompletion, &closeResult));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    if (naettMake(req) == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    for (int i = 0; i < 1000 && closeResult.calls == 0; i++) {
+        usleep(10 * 1000);
+    }
+    if (closeResult.calls != 1) {
+        return fail(__func__, "Expected exactly one callback");
+    }
+    if (closeResult.status != 200) {
+        return fail(__func__, "Expected 200");
+    }
+    naettRes* stray = NULL;
+    if (naettGetCompleted(&stray, 1) != 0) {
+        return fail(__func__, "Response closed in callback was queued");
+    }
+    naettFree(req);
+
+    trace(__func__, "end");
+
     return 1;
 }
 
-#if INCLUDE_MAIN
+int runClientTest(const char* endpoint) {
+    trace(__func__, "begin");
 
-int main(int argc, char** argv) {
-    const char* endpoint = "http://localhost:4711";
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/useragent", endpoint);
 
-    if (argc >= 2) {
-        endpoint = argv[1];
+    naettConfig config = { 0 };
+    config.workerThreads = 1;
+    config.userAgent = "NaettClient/1.0";
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettUseClient(client));
+    naettReq* overridingReq =
+        naettRequest(testURL, naettUserAgent("NaettOverride/1.0"), naettMethod("GET"), naettUseClient(client));
+    if (req == NULL || overridingReq == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    naettRes* res = naettMake(req);
+    naettRes* overridingRes = naettMake(overridingReq);
+    if (res == NULL || overridingRes == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    if (!naettWait(res, 10000) || !naettWait(overridingRes, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    if (naettGetStatus(res) != 200 || naettGetStatus(overridingRes) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+    if (!verifyBody(res, "NaettClient/1.0")) {
+        return fail(__func__, "Expected the client's default user agent");
+    }
+    if (!verifyBody(overridingRes, "NaettOverride/1.0")) {
+        return fail(__func__, "Expected the request's user agent");
+    }
+
+    naettClose(res);
+    naettClose(overridingRes);
+    naettFree(req);
+    naettFree(overridingReq);
+    naettClientFree(client);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runCancelTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/slow", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    naettRes* res = naettMake(req);
+    if (res == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    naettCancel(res);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for cancellation");
+    }
+    if (naettGetStatus(res) != naettCancelledError) {
+        return fail(__func__, "Expected cancelled status");
+    }
+    naettClose(res);
+
+    // Closing a pending response cancels it
+    double start = nowMS();
+    res = naettMake(req);
+    if (res == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    naettClose(res);
+    LOG("%s: closed pending response in %.2f ms\n", __func__, nowMS() - start);
+
+    // Closing a running response whose callback would close it too
+    CallbackResult result = { 0 };
+    naettReq* callbackReq = naettRequest(testURL, naettMethod("GET"), naettOnComplete(closeOnCompletion, &result));
+    if (callbackReq == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    res = naettMake(callbackReq);
+    if (res == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    usleep(50 * 1000);
+    naettClose(res);
+    if (result.calls != 0) {
+        return fail(__func__, "Expected no callback for a closed response");
+    }
+
+    // Closing a response waiting in the admission queue, and the one ahead of it
+    naettConfig config = { 0 };
+    config.maxActive = 1;
+    config.maxQueued = 1;
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+    naettReq* activeReq =
+        naettRequest(testURL, naettMethod("GET"), naettUseClient(client), naettOnComplete(closeOnCompletion, &result));
+    naettReq* queuedReq =
+        naettRequest(testURL, naettMethod("GET"), naettUseClient(client), naettOnComplete(closeOnCompletion, &result));
+    if (activeReq == NULL || queuedReq == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    naettRes* activeRes = naettMake(activeReq);
+    naettRes* queuedRes = naettMake(queuedReq);
+    if (activeRes == NULL || queuedRes == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    naettClose(queuedRes);
+    naettClose(activeRes);
+    if (result.calls != 0) {
+        return fail(__func__, "Expected no callback for a closed response");
+    }
+
+    naettFree(activeReq);
+    naettFree(queuedReq);
+    naettClientFree(client);
+    naettFree(callbackReq);
+    naettFree(req);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+#if __linux__ && !__ANDROID__
+static int expectStatus(const char* url, naettOption* timeout, int expectedStatus) {
+    naettReq* req = naettRequest(url, naettMethod("GET"), timeout);
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    naettRes* res = naettMake(req);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    int status = naettGetStatus(res);
+    naettClose(res);
+    naettFree(req);
+
+    if (status != expectedStatus) {
+        LOG("%s: expected status %d for %s, got %d\n", __func__, expectedStatus, url, status);
+        return 0;
+    }
+    return 1;
+}
+
+// Opens a local listening socket that never accepts, with its backlog filled by
+// connections of its own, so that further connection attempts hang.
+// Returns the port, or 0 on failure. `sockets` receives the sockets to close afterwards.
+static int openStalledListener(int sockets[3]) {
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+
+    sockets[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockets[0] < 0 || bind(sockets[0], (struct sockaddr*)&address, addressLength) != 0 ||
+        listen(sockets[0], 0) != 0 || getsockname(sockets[0], (struct sockaddr*)&address, &addressLength) != 0) {
+        return 0;
+    }
+    for (int i = 1; i < 3; i++) {
+        sockets[i] = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(sockets[i], F_SETFL, O_NONBLOCK);
+        connect(sockets[i], (struct sockaddr*)&address, addressLength);
+    }
+    usleep(50 * 1000);
+    return ntohs(address.sin_port);
+}
+
+int runTimeoutTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char slowURL[512];
+    snprintf(slowURL, sizeof(slowURL), "%s/slow", endpoint);
+    char trickleURL[512];
+    snprintf(trickleURL, sizeof(trickleURL), "%s/trickle", endpoint);
+    char crawlURL[512];
+    snprintf(crawlURL, sizeof(crawlURL), "%s/crawl", endpoint);
+
+    if (!expectStatus(slowURL, naettDeadline(100), naettDeadlineError) ||
+        !expectStatus(trickleURL, naettDeadline(100), naettDeadlineError)) {
+        return fail(__func__, "Expected the deadline to pass");
+    }
+    if (!expectStatus(slowURL, naettFirstByteTimeout(100), naettFirstByteTimeoutError) ||
+        !expectStatus(trickleURL, naettFirstByteTimeout(100), 200)) {
+        return fail(__func__, "Expected the first byte timeout to apply before the response only");
+    }
+    if (!expectStatus(trickleURL, naettIdleTimeout(100), naettIdleTimeoutError) ||
+        !expectStatus(slowURL, naettIdleTimeout(100), 200)) {
+        return fail(__func__, "Expected the idle timeout to apply once the response has started");
+    }
+    if (!expectStatus(crawlURL, naettLowSpeed(100, 1), naettLowSpeedError) ||
+        !expectStatus(trickleURL, naettLowSpeed(1, 1), 200)) {
+        return fail(__func__, "Expected the low speed limit to abort slow transfers only");
+    }
+    if (!expectStatus("http://localhost:1/", naettTimeout(1000), naettConnectionError)) {
+        return fail(__func__, "Expected connection error");
+    }
+
+    int sockets[3] = { -1, -1, -1 };
+    int stalledPort = openStalledListener(sockets);
+    if (stalledPort == 0) {
+        return fail(__func__, "Failed to open listening socket");
+    }
+    char stalledURL[512];
+    snprintf(stalledURL, sizeof(stalledURL), "http://127.0.0.1:%d/", stalledPort);
+    int timedOut = expectStatus(stalledURL, naettTimeout(200), naettConnectTimeoutError);
+    for (int i = 0; i < 3; i++) {
+        close(sockets[i]);
+    }
+    if (!timedOut) {
+        return fail(__func__, "Expected connect timeout");
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+#endif
+
+int runBatchTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/get", endpoint);
+
+    const int numRequests = 10;
+    naettReq* requests[numRequests];
+    naettRes* responses[numRequests];
+
+    for (int i = 0; i < numRequests; i++) {
+        requests[i] = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+        if (requests[i] == NULL) {
+            return fail(__func__, "Failed to create request");
+        }
+    }
+
+    naettMakeBatch(requests, numRequests, responses);
+
+    for (int i = 0; i < numRequests; i++) {
+        if (responses[i] == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+        if (!naettWait(responses[i], 10000)) {
+            return fail(__func__, "Timed out waiting for response");
+        }
+        if (naettGetStatus(responses[i]) != 200 || !verifyBody(responses[i], "OK")) {
+            return fail(__func__, "Expected 200");
+        }
+        naettClose(responses[i]);
+        naettFree(requests[i]);
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runAdmissionTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/slow", endpoint);
+
+    naettConfig config = { 0 };
+    config.maxActive = 1;
+    config.maxQueued = 1;
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettUseClient(client));
+    naettReq* queuedReq = naettRequest(testURL, naettMethod("GET"), naettUseClient(client));
+    CallbackResult rejectedResult = { 0 };
+    naettReq* rejectedReq = naettRequest(
+        testURL, naettMethod("GET"), naettUseClient(client), naettOnComplete(recordCompletion, &rejectedResult));
+    if (req == NULL || queuedReq == NULL || rejectedReq == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    naettRes* res = naettMake(req);
+    naettRes* queuedRes = naettMake(queuedReq);
+    naettRes* rejectedRes = naettMake(rejectedReq);
+
+    if (!naettComplete(rejectedRes) || naettGetStatus(rejectedRes) != naettWouldBlockError) {
+        return fail(__func__, "Expected request over the limits to be rejected");
+    }
+    if (rejectedResult.calls != 0) {
+        return fail(__func__, "Expected no callback for a rejected request");
+    }
+    if (!naettWait(queuedRes, 10000) || !naettComplete(res)) {
+        return fail(__func__, "Expected queued request to complete after the active one");
+    }
+    if (naettGetStatus(res) != 200 || naettGetStatus(queuedRes) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+
+    // The slot is free again.
+    naettRes* retriedRes = naettMake(rejectedReq);
+    naettClose(rejectedRes);
+    if (!naettWait(retriedRes, 10000) || naettGetStatus(retriedRes) != 200) {
+        return fail(__func__, "Expected retried request to succeed");
+    }
+    if (rejectedResult.calls != 1) {
+        return fail(__func__, "Expected a callback for the retried request");
+    }
+
+    naettClose(res);
+    naettClose(queuedRes);
+    naettClose(retriedRes);
+    naettFree(req);
+    naettFree(queuedReq);
+    naettFree(rejectedReq);
+    naettClientFree(client);
+
+    // Closing a response in the middle of the queue keeps the others in order
+    config.maxQueued = 3;
+    client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+    req = naettRequest(testURL, naettMethod("GET"), naettUseClient(client));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    naettRes* responses[4];
+    for (int i = 0; i < 4; i++) {
+        responses[i] = naettMake(req);
+    }
+    naettClose(responses[2]);
+    for (int i = 0; i < 4; i++) {
+        if (i == 2) {
+            continue;
+        }
+        if (!naettWait(responses[i], 10000) || naettGetStatus(responses[i]) != 200) {
+            return fail(__func__, "Expected the remaining queued requests to succeed");
+        }
+        naettClose(responses[i]);
+    }
+    naettFree(req);
+    naettClientFree(client);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+#if __linux__ && !__ANDROID__
+int runConnectionLimitTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/slow", endpoint);
+
+    naettConfig config = { 0 };
+    config.workerThreads = 1;
+    config.maxHostConnections = 1;
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+
+    const int numRequests = 3;
+    naettReq* requests[numRequests];
+    naettRes* responses[numRequests];
+    double start = nowMS();
+
+    for (int i = 0; i < numRequests; i++) {
+        requests[i] = naettRequest(testURL, naettMethod("GET"), naettHTTPVersion(naettHTTP1_1), naettUseClient(client));
+        if (requests[i] == NULL) {
+            return fail(__func__, "Failed to create request");
+        }
+        responses[i] = naettMake(requests[i]);
+        if (responses[i] == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+    }
+
+    for (int i = 0; i < numRequests; i++) {
+        if (!naettWait(responses[i], 10000)) {
+            return fail(__func__, "Timed out waiting for response");
+        }
+        if (naettGetStatus(responses[i]) != 200) {
+            return fail(__func__, "Expected queued requests to succeed");
+        }
+    }
+
+    // Each /slow request takes 500ms, so over a single connection they run one after another.
+    double elapsed = nowMS() - start;
+    LOG("%s: %d requests over one connection took %.0f ms\n", __func__, numRequests, elapsed);
+    if (elapsed < (numRequests - 1) * 500) {
+        return fail(__func__, "Expected requests to wait for the connection");
+    }
+
+    for (int i = 0; i < numRequests; i++) {
+        naettClose(responses[i]);
+        naettFree(requests[i]);
+    }
+    naettClientFree(client);
+
+    // The total limit holds across hosts and workers, also with more workers than connections
+    config.workerThreads = 4;
+    config.maxHostConnections = 0;
+    config.maxConnections = 1;
+    client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+    const char* port = strrchr(endpoint, ':');
+    // Loopback addresses that spread over the workers
+    enum { numHosts = 4 };
+    const char* hosts[numHosts] = { "127.0.0.1", "127.0.0.2", "127.0.0.3", "127.0.0.4" };
+    naettReq* hostRequests[numHosts];
+    naettRes* hostResponses[numHosts];
+    start = nowMS();
+    for (int i = 0; i < numHosts; i++) {
+        snprintf(testURL, sizeof(testURL), "http://%s%s/slow", hosts[i], port);
+        hostRequests[i] =
+            naettRequest(testURL, naettMethod("GET"), naettHTTPVersion(naettHTTP1_1), naettUseClient(client));
+        hostResponses[i] = naettMake(hostRequests[i]);
+    }
+    for (int i = 0; i < numHosts; i++) {
+        if (!naettWait(hostResponses[i], 10000) || naettGetStatus(hostResponses[i]) != 200) {
+            return fail(__func__, "Expected requests to all hosts to succeed");
+        }
+        naettClose(hostResponses[i]);
+        naettFree(hostRequests[i]);
+    }
+    elapsed = nowMS() - start;
+    LOG("%s: 4 requests to different hosts over one connection took %.0f ms\n", __func__, elapsed);
+    if (elapsed < (numHosts - 1) * 500) {
+        return fail(__func__, "Expected requests to different hosts to share the total limit");
+    }
+    naettClientFree(client);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+#endif
+
+int runStressTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+#if COUNT_ALLOCATIONS
+    unsigned long allocationsBefore = allocations();
+#endif
+
+    const int iterations = 8000;
+    for (int i = 0; i < iterations; i++) {
+        naettRes* res = naettMake(req);
+        if (res == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+
+        if (!naettWait(res, 10000)) {
+            return fail(__func__, "Timed out waiting for response");
+        }
+
+        int status = naettGetStatus(res);
+
+        if (status < 0) {
+            return fail(__func__, "Connection failed");
+        }
+
+        if (!verifyBody(res, "OK")) {
+            return 0;
+        }
+
+        if (naettGetStatus(res) != 200) {
+            return fail(__func__, "Expected 200");
+        }
+
+        naettClose(res);
+    }
+
+#if COUNT_ALLOCATIONS
+    LOG("%s: %.2f allocations per request\n", __func__, (double)(allocations() - allocationsBefore) / iterations);
+#endif
+
+    naettFree(req);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runCompletionQueueTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/get", endpoint);
+
+    enum { numRequests = 10 };
+    naettReq* requests[numRequests];
+    naettRes* responses[numRequests];
+
+    for (int i = 0; i < numRequests; i++) {
+        requests[i] = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+        if (requests[i] == NULL) {
+            return fail(__func__, "Failed to create request");
+        }
+        responses[i] = naettMake(requests[i]);
+        if (responses[i] == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+    }
+
+    int completionFD = naettCompletionFD();
+#if __linux__ && !__ANDROID__
+    if (completionFD < 0) {
+        return fail(__func__, "Expected a completion file descriptor");
+    }
+#endif
+
+    int remaining = numRequests;
+    while (remaining > 0) {
+#if __linux__ && !__ANDROID__
+        struct pollfd pollFD = { completionFD, POLLIN, 0 };
+        if (poll(&pollFD, 1, 5000) != 1) {
+            return fail(__func__, "Timed out waiting for completion");
+        }
+#else
+        (void)completionFD;
+        usleep(10 * 1000);
+#endif
+
+        naettRes* completed[numRequests];
+        int count = naettGetCompleted(completed, numRequests);
+        for (int i = 0; i < count; i++) {
+            int found = 0;
+            for (int j = 0; j < numRequests; j++) {
+                if (responses[j] == completed[i]) {
+                    responses[j] = NULL;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                return fail(__func__, "Collected unknown or duplicate response");
+            }
+            if (!naettComplete(completed[i])) {
+                return fail(__func__, "Collected incomplete response");
+            }
+            if (!verifyBody(completed[i], "OK")) {
+                return 0;
+            }
+            naettClose(completed[i]);
+            remaining--;
+        }
+    }
+
+#if __linux__ && !__ANDROID__
+    struct pollfd pollFD = { completionFD, POLLIN, 0 };
+    if (poll(&pollFD, 1, 0) != 0) {
+        return fail(__func__, "Completion descriptor readable with empty queue");
+    }
+#endif
+
+    for (int i = 0; i < numRequests; i++) {
+        naettFree(requests[i]);
+    }
+
+    // Responses are only collected through their own client, and never when they have callbacks
+    naettConfig config = { 0 };
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return fail(__func__, "Failed to create client");
+    }
+    CallbackResult result = { 0 };
+    naettReq* clientReq = naettRequest(testURL, naettHeader("accept", "naett/testresult"), naettUseClient(client));
+    naettReq* callbackReq =
+        naettRequest(testURL, naettHeader("accept", "naett/testresult"), naettOnComplete(recordCompletion, &result));
+    if (clientReq == NULL || callbackReq == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    naettRes* clientRes = naettMake(clientReq);
+    naettRes* callbackRes = naettMake(callbackReq);
+    if (clientRes == NULL || callbackRes == NULL) {
+        return fail(__func__, "Failed to make request");
+    }
+    // Waiting across clients is woken by completions of either client
+    naettRes* waited[] = { clientRes, callbackRes };
+    int index = -1;
+    if (!naettWaitAny(waited, 2, 10000, &index)) {
+        return fail(__func__, "Timed out waiting for any response");
+    }
+    if (!naettWait(clientRes, 10000) || !naettWait(callbackRes, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+
+    naettRes* completed[2];
+    if (naettGetCompleted(completed, 2) != 0) {
+        return fail(__func__, "Collected a response of another client, or one with a callback");
+    }
+#if __linux__ && !__ANDROID__
+    struct pollfd clientPollFDs[2] = {
+        { naettClientCompletionFD(client), POLLIN, 0 },
+        { completionFD, POLLIN, 0 },
+    };
+    if (clientPollFDs[0].fd == completionFD || poll(clientPollFDs, 2, 0) != 1 || clientPollFDs[1].revents != 0) {
+        return fail(__func__, "Expected only the client completion descriptor to be readable");
+    }
+#endif
+    if (naettClientGetCompleted(client, completed, 2) != 1 || completed[0] != clientRes) {
+        return fail(__func__, "Expected to collect the client response");
+    }
+
+    naettClose(clientRes);
+    naettClose(callbackRes);
+    naettFree(clientReq);
+    naettFree(callbackReq);
+    naettClientFree(client);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+#if COUNT_ALLOCATIONS
+int runHeaderAllocationBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+
+    naettReq* req = naettRequest(testURL,
+        naettMethod("GET"),
+        naettHeader("accept", "naett/testresult"),
+        naettHeader("accept-language", "en"),
+        naettHeader("cache-control", "no-cache"),
+        naettHeader("x-request-source", "naett-testrig"),
+        naettHeader("x-trace-id", "0123456789abcdef"),
+        naettHeader("x-tenant", "test"),
+        naettHeader("x-feature", "headers"),
+        naettHeader("x-client-version", "1.0"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    const int iterations = 1000;
+    unsigned long allocationsBefore = allocations();
+
+    for (int i = 0; i < iterations; i++) {
+        naettRes* res = naettMake(req);
+        if (!naettWait(res, 10000)) {
+            return fail(__func__, "Timed out waiting for response");
+        }
+        if (naettGetStatus(res) != 200) {
+            return fail(__func__, "Expected 200");
+        }
+        naettClose(res);
+    }
+
+    LOG("%s: %.2f allocations per request with 8 headers\n",
+        __func__,
+        (double)(allocations() - allocationsBefore) / iterations);
+
+    naettFree(req);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runBodyAllocationBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/large", endpoint);
+
+    // Default preallocation limit, and none
+    int limits[] = { 0, -1 };
+    for (int l = 0; l < 2; l++) {
+        naettConfig config = { 0 };
+        config.maxBodyPreallocation = limits[l];
+        naettClient* client = naettClientCreate(&config);
+        if (client == NULL) {
+            return fail(__func__, "Failed to create client");
+        }
+        naettReq* req = naettRequest(testURL, naettMethod("GET"), naettUseClient(client));
+        if (req == NULL) {
+            return fail(__func__, "Failed to create request");
+        }
+
+        const int iterations = 50;
+        unsigned long allocationsBefore = allocations();
+        double start = nowMS();
+
+        for (int i = 0; i < iterations; i++) {
+            naettRes* res = naettMake(req);
+            if (!naettWait(res, 10000)) {
+                return fail(__func__, "Timed out waiting for response");
+            }
+            int bodyLength = 0;
+            naettGetBody(res, &bodyLength);
+            if (naettGetStatus(res) != 200 || bodyLength != 1000000) {
+                return fail(__func__, "Expected 200 and a 1 MB body");
+            }
+            naettClose(res);
+        }
+
+        LOG("%s: %.2f ms and %.2f allocations per 1 MB response %s\n",
+            __func__,
+            (nowMS() - start) / iterations,
+            (double)(allocations() - allocationsBefore) / iterations,
+            limits[l] < 0 ? "without preallocation" : "with preallocation");
+
+        naettFree(req);
+        naettClientFree(client);
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+#endif
+
+#if __linux__ && !__ANDROID__
+
+enum { submitThreads = 4, submitsPerThread = 250 };
+
+typedef struct {
+    const char* url;
+    naettReq* requests[submitsPerThread];
+    naettRes* responses[submitsPerThread];
+    int batched;
+    double submitMS;
+} SubmitWork;
+
+static void* submitRequests(void* data) {
+    SubmitWork* work = (SubmitWork*)data;
+    double start = nowMS();
+    if (work->batched) {
+        naettMakeBatch(work->requests, submitsPerThread, work->responses);
+    } else {
+        for (int i = 0; i < submitsPerThread; i++) {
+            work->responses[i] = naettMake(work->requests[i]);
+        }
+    }
+    work->submitMS = nowMS() - start;
+    return NULL;
+}
+
+static int benchmarkSubmission(const char* endpoint, int batched) {
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+
+    static SubmitWork work[submitThreads];
+    pthread_t threads[submitThreads];
+
+    for (int t = 0; t < submitThreads; t++) {
+        work[t].batched = batched;
+        for (int i = 0; i < submitsPerThread; i++) {
+            work[t].requests[i] = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+            if (work[t].requests[i] == NULL) {
+                return fail(__func__, "Failed to create request");
+            }
+        }
+    }
+
+    double start = nowMS();
+    for (int t = 0; t < submitThreads; t++) {
+        pthread_create(&threads[t], NULL, submitRequests, &work[t]);
+    }
+    double submitMS = 0;
+    for (int t = 0; t < submitThreads; t++) {
+        pthread_join(threads[t], NULL);
+        submitMS += work[t].submitMS;
+    }
+    double allSubmittedMS = nowMS() - start;
+
+    for (int t = 0; t < submitThreads; t++) {
+        for (int i = 0; i < submitsPerThread; i++) {
+            naettRes* res = work[t].responses[i];
+            if (res == NULL) {
+                return fail(__func__, "Failed to make request");
+            }
+            if (!naettWait(res, 10000)) {
+                return fail(__func__, "Timed out waiting for response");
+            }
+            if (naettGetStatus(res) != 200) {
+                return fail(__func__, "Expected 200");
+            }
+            naettClose(res);
+            naettFree(work[t].requests[i]);
+        }
+    }
+    double totalMS = nowMS() - start;
+
+    const int numRequests = submitThreads * submitsPerThread;
+    LOG("runSubmitBenchmark: %d threads submitted %d requests in %.2f ms, %.2f us per request using %s, all complete in %.2f ms\n",
+        submitThreads,
+        numRequests,
+        allSubmittedMS,
+        submitMS * 1000.0 / numRequests,
+        batched ? "naettMakeBatch" : "naettMake",
+        totalMS);
+
+    return 1;
+}
+
+int runSubmitBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    if (!benchmarkSubmission(endpoint, 0) || !benchmarkSubmission(endpoint, 1)) {
+        return 0;
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+#endif  // __linux__ && !__ANDROID__
+
+int runHeaderLookupBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/headers", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+    naettRes* res = naettMake(req);
+    if (!naettWait(res, 10000)) {
+        return fail(__func__, "Timed out waiting for response");
+    }
+    if (naettGetStatus(res) != 200) {
+        return fail(__func__, "Expected 200");
+    }
+
+    // A handful of lookups per response, as when routing on headers.
+    const char* names[] = {
+        "content-type", "content-length", "date", "x-header-3", "x-header-12", "x-header-23", "x-missing", "etag",
+    };
+    const int numNames = sizeof(names) / sizeof(names[0]);
+    const int iterations = 100000;
+    int found = 0;
+
+    double start = nowMS();
+    for (int i = 0; i < iterations; i++) {
+        for (int n = 0; n < numNames; n++) {
+            found += naettGetHeader(res, names[n]) != NULL;
+        }
+    }
+    double elapsedMS = nowMS() - start;
+
+    if (found != iterations * 6) {
+        return fail(__func__, "Unexpected number of headers found");
+    }
+
+    LOG("%s: %.1f ns per lookup\n", __func__, elapsedMS * 1000000.0 / ((double)iterations * numNames));
+
+    naettClose(res);
+    naettFree(req);
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runHeaderParseBenchmark(void) {
+    trace(__func__, "begin");
+
+    // Header lines as delivered by libcurl, from a typical CDN fronted API response
+    const char* lines[] = {
+        "HTTP/1.1 200 OK\r\n",
+        "Date: Sat, 17 Oct 2026 09:21:07 GMT\r\n",
+        "Content-Type: application/json; charset=utf-8\r\n",
+        "Content-Length: 4821\r\n",
+        "Connection: keep-alive\r\n",
+        "Cache-Control: public, max-age=300, s-maxage=600, stale-while-revalidate=30\r\n",
+        "ETag: W/\"12d1-5e15153d3c4a8\"\r\n",
+        "Last-Modified: Fri, 16 Oct 2026 22:03:11 GMT\r\n",
+        "Vary: Accept-Encoding, Origin\r\n",
+        "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n",
+        "X-Content-Type-Options: nosniff\r\n",
+        "X-Frame-Options: DENY\r\n",
+        "Content-Security-Policy: default-src 'self'; img-src * data:; frame-ancestors 'none'\r\n",
+        "Access-Control-Allow-Origin: *\r\n",
+        "Set-Cookie: session=5f2b8c0e4a1d9e7f; Path=/; HttpOnly; Secure; SameSite=Lax\r\n",
+        "Set-Cookie: region=eu-north-1; Path=/; Max-Age=86400\r\n",
+        "X-Request-Id: 6c1f3a0e-8f5b-4d2e-9b7a-1e2d3c4b5a69\r\n",
+        "X-Cache: Hit from cloudfront\r\n",
+        "Age: 137\r\n",
+        "Via: 1.1 3f9c1d2e8a7b6c5d.cloudfront.net (CloudFront)\r\n",
+        "Server: nginx/1.25.3\r\n",
+        "Alt-Svc: h3=\":443\"; ma=86400\r\n",
+        "\r\n",
+    };
+    const int numLines = sizeof(lines) / sizeof(lines[0]);
+    size_t lengths[sizeof(lines) / sizeof(lines[0])];
+    for (int i = 0; i < numLines; i++) {
+        lengths[i] = strlen(lines[i]);
+    }
+
+    const int iterations = 100000;
+    int found = 0;
+
+    double start = nowMS();
+    for (int i = 0; i < iterations; i++) {
+        InternalResponse res;
+        memset(&res, 0, sizeof(res));
+        for (int l = 0; l < numLines; l++) {
+            naettParseHeaderLine(&res, lines[l], lengths[l]);
+        }
+        found += res.headers.count;
+        naettArenaFree(&res.arena);
+    }
+    double elapsedMS = nowMS() - start;
+
+    if (found != iterations * (numLines - 2)) {
+        return fail(__func__, "Unexpected number of headers parsed");
+    }
+
+    LOG("%s: %.1f ns per header line\n", __func__, elapsedMS * 1000000.0 / ((double)iterations * numLines));
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runRequestConstructionBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/post", endpoint);
+
+    const naettHeaderPair headers[] = {
+        { "accept", "naett/testresult" },
+        { "cache-control", "no-cache" },
+        { "x-trace-id", "0123456789abcdef" },
+    };
+    naettRequestConfig config = { 0 };
+    config.method = "POST";
+    config.headers = headers;
+    config.numHeaders = 3;
+    config.body = "TestRequest!";
+    config.bodySize = 12;
+
+    naettReq* req = naettRequestWithConfig(testURL, &config);
+    if (req == NULL || !makeAndVerify(req, "OK")) {
+        return fail(__func__, "Expected request built from config to succeed");
+    }
+    naettFree(req);
+
+    const int iterations = 20000;
+    for (int useConfig = 0; useConfig <= 1; useConfig++) {
+#if COUNT_ALLOCATIONS
+        unsigned long allocationsBefore = allocations();
+#endif
+        double start = nowMS();
+        for (int i = 0; i < iterations; i++) {
+            if (useConfig) {
+                req = naettRequestWithConfig(testURL, &config);
+            } else {
+                req = naettRequest(testURL,
+                    naettMethod("POST"),
+                    naettHeader("accept", "naett/testresult"),
+                    naettHeader("cache-control", "no-cache"),
+                    naettHeader("x-trace-id", "0123456789abcdef"),
+                    naettBody("TestRequest!", 12));
+            }
+            naettFree(req);
+        }
+        double elapsedMS = nowMS() - start;
+
+        LOG("%s: %.3f us per request using %s",
+            __func__,
+            elapsedMS * 1000.0 / iterations,
+            useConfig ? "naettRequestWithConfig" : "naettRequest");
+#if COUNT_ALLOCATIONS
+        LOG(", %.2f allocations", (double)(allocations() - allocationsBefore) / iterations);
+#endif
+        LOG("\n");
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+#if __linux__ && !__ANDROID__
+int runDispatchLatencyBenchmark(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+    if (req == NULL) {
+        return fail(__func__, "Failed to create request");
+    }
+
+    const int iterations = 50;
+    double totalMS = 0;
+    double maxMS = 0;
+    double totalRoundTripMS = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        // Let the worker go idle, so that each request measures the wakeup latency.
+        usleep(20 * 1000);
+
+        double start = nowMS();
+        naettRes* res = naettMake(req);
+        if (res == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+
+        naettWait(res, -1);
+        totalRoundTripMS += nowMS() - start;
+
+        if (naettGetStatus(res) != 200) {
+            return fail(__func__, "Expected 200");
+        }
+        // Stamped by the worker thread as it adds the transfer, with the clock of nowMS.
+        double dispatchedMS = (double)((InternalResponse*)res)->addedNS / 1000000.0;
+        naettClose(res);
+        if (dispatchedMS < start) {
+            return fail(__func__, "Expected a dispatch time after submission");
+        }
+
+        double elapsed = dispatchedMS - start;
+        totalMS += elapsed;
+        if (elapsed > maxMS) {
+            maxMS = elapsed;
+        }
+    }
+
+    naettFree(req);
+
+    LOG("%s: %d idle submissions, dispatched after mean %.3f ms, max %.3f ms, round trip mean %.2f ms\n",
+        __func__,
+        iterations,
+        totalMS / iterations,
+        maxMS,
+        totalRoundTripMS / iterations);
+    trace(__func__, "end");
+
+    return 1;
+}
+#endif
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int runConcurrencyTest(const char* endpoint) {
+    trace(__func__, "begin");
+
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/stress", endpoint);
+
+    enum { numRequests = 200 };
+    naettReq* requests[numRequests];
+    naettRes* responses[numRequests];
+    double latencies[numRequests];
+
+    for (int i = 0; i < numRequests; i++) {
+        requests[i] = naettRequest(testURL, naettMethod("GET"), naettHeader("accept", "naett/testresult"));
+        if (requests[i] == NULL) {
+            return fail(__func__, "Failed to create request");
+        }
+    }
+
+    double start = nowMS();
+    for (int i = 0; i < numRequests; i++) {
+        responses[i] = naettMake(requests[i]);
+        if (responses[i] == NULL) {
+            return fail(__func__, "Failed to make request");
+        }
+        latencies[i] = -1;
+    }
+
+    int remaining = numRequests;
+    while (remaining > 0) {
+        for (int i = 0; i < numRequests; i++) {
+            if (latencies[i] < 0 && naettComplete(responses[i])) {
+                latencies[i] = nowMS() - start;
+                remaining--;
+            }
+        }
+        usleep(50);
+    }
+    double totalMS = nowMS() - start;
+
+    for (int i = 0; i < numRequests; i++) {
+        if (naettGetStatus(responses[i]) != 200) {
+            return fail(__func__, "Expected 200");
+        }
+        if (!verifyBody(responses[i], "OK")) {
+            return 0;
+        }
+        naettClose(responses[i]);
+        naettFree(requests[i]);
+    }
+
+    qsort(latencies, numRequests, sizeof(double), compareDoubles);
+    LOG("%s: %d concurrent requests in %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        __func__,
+        numRequests,
+        totalMS,
+        latencies[numRequests / 2],
+        latencies[numRequests * 99 / 100],
+        latencies[numRequests - 1]);
+    trace(__func__, "end");
+
+    return 1;
+}
+
+// Cleartext HTTP/2 endpoint, only set when the test rig serves one.
+const char* http2Endpoint = NULL;
+
+static int readConnectionCount(const char* endpoint) {
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/connections", endpoint);
+
+    naettReq* req = naettRequest(testURL, naettMethod("GET"), naettHTTPVersion(naettHTTP1_1));
+    naettRes* res = naettMake(req);
+    naettWait(res, 10000);
+
+    char count[32] = { 0 };
+    int bodyLength = 0;
+    const char* body = naettGetBody(res, &bodyLength);
+    if (naettGetStatus(res) == 200 && bodyLength < (int)sizeof(count)) {
+        memcpy(count, body, bodyLength);
+    }
+
+    naettClose(res);
+    naettFree(req);
+    return atoi(count);
+}
+
+// Makes concurrent requests from a client of their own, with its own connection cache.
+// libcurl 7.x sends HTTP/2 prior knowledge requests over cached HTTP/1.1 connections.
+static int fanOut(const char* endpoint, int version) {
+    char testURL[512];
+    snprintf(testURL, sizeof(testURL), "%s/get", endpoint);
+
+    enum { numRequests = 20 };
+    naettReq* requests[numRequests];
+    naettRes* responses[numRequests];
+
+    naettConfig config = { 0 };
+    naettClient* client = naettClientCreate(&config);
+    if (client == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < numRequests; i++) {
+        requests[i] = naettRequest(testURL,
+            naettMethod("GET"),
+            naettHeader("accept", "naett/testresult"),
+            naettHTTPVersion(version),
+            naettUseClient(client));
+        responses[i] = naettMake(requests[i]);
+    }
+
+    int ok = 1;
+    for (int i = 0; i < numRequests; i++) {
+        if (!naettWait(responses[i], 10000) || naettGetStatus(responses[i]) != 200) {
+            ok = 0;
+        }
+        naettClose(responses[i]);
+        naettFree(requests[i]);
+    }
+    naettClientFree(client);
+    return ok;
+}
+
+int runHTTP2Test(const char* endpoint) {
+    trace(__func__, "begin");
+
+    int initialConnections = readConnectionCount(endpoint);
+    if (!fanOut(endpoint, naettHTTP1_1)) {
+        return fail(__func__, "HTTP/1.1 requests failed");
+    }
+    int http1Connections = readConnectionCount(endpoint) - initialConnections;
+    if (!fanOut(endpoint, naettHTTP2PriorKnowledge)) {
+        return fail(__func__, "HTTP/2 requests failed");
+    }
+    int http2Connections = readConnectionCount(endpoint) - initialConnections - http1Connections;
+
+    LOG("%s: 20 concurrent requests opened %d connections over HTTP/1.1, %d over HTTP/2\n",
+        __func__,
+        http1Connections,
+        http2Connections);
+
+#if __linux__ && !__ANDROID__
+    // Older libcurl cannot wait for prior knowledge connections, see naettPlatformInit
+    int multiplexed = curl_version_info(CURLVERSION_NOW)->version_num >= 0x080000;
+#else
+    // `naettHTTPVersion` is Linux only, and the other platforms do not share connections between requests
+    int multiplexed = 0;
+#endif
+    if (multiplexed && http2Connections >= http1Connections) {
+        return fail(__func__, "Expected HTTP/2 requests to share connections");
+    }
+
+    trace(__func__, "end");
+
+    return 1;
+}
+
+int runTests(const char* endpoint) {
+    if (!runGETTest(endpoint)) {
+        return 0;
+    }
+    if (!runPOSTTest(endpoint)) {
+        return 0;
+    }
+    if (!runConcurrentMakeTest(endpoint)) {
+        return 0;
+    }
+    if (!runCloneTest(endpoint)) {
+        return 0;
+    }
+    if (!runRedirectTest(endpoint)) {
+        return 0;
+    }
+    if (!runHeaderTest(endpoint)) {
+        return 0;
+    }
+#if __linux__ && !__ANDROID__
+    if (!runLargeBodyTest(endpoint)) {
+        return 0;
+    }
+#endif
+    if (!runWaitTest(endpoint)) {
+        return 0;
+    }
+    if (!runCompletionCallbackTest(endpoint)) {
+        return 0;
+    }
+    if (!runClientTest(endpoint)) {
+        return 0;
+    }
+    if (!runCancelTest(endpoint)) {
+        return 0;
+    }
+#if __linux__ && !__ANDROID__
+    if (!runTimeoutTest(endpoint)) {
+        return 0;
+    }
+#endif
+    if (!runBatchTest(endpoint)) {
+        return 0;
+    }
+    if (!runAdmissionTest(endpoint)) {
+        return 0;
+    }
+#if __linux__ && !__ANDROID__
+    if (!runConnectionLimitTest(endpoint)) {
+        return 0;
+    }
+#endif
+    if (!runStressTest(endpoint)) {
+        return 0;
+    }
+    if (http2Endpoint != NULL && !runHTTP2Test(http2Endpoint)) {
+        return 0;
+    }
+    if (!runConcurrencyTest(endpoint)) {
+        return 0;
+    }
+    if (!runCompletionQueueTest(endpoint)) {
+        return 0;
+    }
+#if COUNT_ALLOCATIONS
+    if (!runHeaderAllocationBenchmark(endpoint)) {
+        return 0;
+    }
+    if (!runBodyAllocationBenchmark(endpoint)) {
+        return 0;
+    }
+#endif
+#if __linux__ && !__ANDROID__
+    if (!runSubmitBenchmark(endpoint)) {
+        return 0;
+    }
+#endif
+    if (!runHeaderLookupBenchmark(endpoint)) {
+        return 0;
+    }
+    if (!runHeaderParseBenchmark()) {
+        return 0;
+    }
+    if (!runRequestConstructionBenchmark(endpoint)) {
+        return 0;
+    }
+#if __linux__ && !__ANDROID__
+    if (!runDispatchLatencyBenchmark(endpoint)) {
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+#if INCLUDE_MAIN
+
+int main(int argc, char** argv) {
+    const char* endpoint = "http://localhost:4711";
+
+    if (argc >= 2) {
+        endpoint = argv[1];
+    }
+    if (argc >= 3) {
+        http2Endpoint = argv[2];
     }
 
     printf("Running tests using %s\n", endpoint);
 
-    naettInit(NULL);
+    naettConfig config = { 0 };
+    config.workerThreads = 2;
+    naettInitWithConfig(NULL, &config);
     if (runTests(endpoint)) {
         printf("All tests pass OK\n");
         return 0;